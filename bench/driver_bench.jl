@@ -0,0 +1,82 @@
+# Load test of the Julia driver against the firmware emulator.
+#
+#   make jlbench
+#
+# or: ./host_emulator -l /tmp/host_emulator -e 5 &
+#     julia --project bench/driver_bench.jl /tmp/host_emulator
+#
+# With several ports, measures aggregate commands per second through a
+# MegaManager.
+
+using ArduinoMega2560
+using ArduinoMega2560: MegaGPIO, MegaUSART, enable_monitor, disable_monitor,
+                       on_monitor, MegaManager, broadcast_command
+
+percentile(v, p) = v[clamp(round(Int, p / 100 * length(v)), 1, length(v))]
+
+function bench_commands(m, n)
+    latency = Vector{Float64}(undef, n)
+    t0 = time()
+    for i in 1:n
+        t = time_ns()
+        m["B5"]
+        latency[i] = (time_ns() - t) / 1e3
+    end
+    t = time() - t0
+    sort!(latency)
+    println("commands:      $(round(Int, n / t)) cmd/s")
+    for p in (50, 90, 99)
+        println("latency p$p:   $(round(percentile(latency, p); digits=1)) us")
+    end
+    println("latency max:   $(round(latency[end]; digits=1)) us")
+end
+
+function bench_events(m, seconds)
+    n = 0
+    on_monitor(m) do line, l
+        n += 1
+    end
+    for pin in 0:7
+        enable_monitor(m, "A$pin")
+    end
+    sleep(seconds)
+    for pin in 0:7
+        disable_monitor(m, "A$pin")
+    end
+    on_monitor(nothing, m)
+    println("events:        $(round(Int, n / seconds)) event/s")
+    println("dropped:       $(m.monitor.dropped)")
+end
+
+function bench_usart(m, n)
+    u = MegaUSART(m, 1)
+    empty!(u)
+    t0 = time()
+    for i in 1:n
+        write(u, "line $i")
+        @assert take!(u) == "line $i"
+    end
+    println("USART1 echo:   $(round(Int, n / (time() - t0))) line/s")
+end
+
+function bench_manager(ports, n)
+    mgr = MegaManager(ports)
+    t0 = time()
+    for i in 1:n
+        broadcast_command(mgr, "IB5")
+    end
+    t = time() - t0
+    println("$(length(ports)) boards:      " *
+            "$(round(Int, n * length(ports) / t)) cmd/s")
+    close(mgr)
+end
+
+if length(ARGS) == 1
+    m = MegaGPIO(ARGS[1])
+    bench_commands(m, 10_000)
+    bench_usart(m, 1_000)
+    bench_events(m, 5)
+    close(m)
+else
+    bench_manager(ARGS, 10_000)
+end
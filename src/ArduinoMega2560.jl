@@ -1,8 +1,7 @@
 """
 Julia interface for Aurduino Mega 2560.
 
-
-FIXME Make the comms modbus compatible?
+The firmware can also act as a Modbus RTU slave, see `enable_modbus`.
 """
 module ArduinoMega2560
 
@@ -29,15 +28,99 @@ end
 
 
 
+# Received Line Buffers.
+
+const LINE_MAX = 512
+
+"""
+    LineRing(capacity)
+
+Preallocated ring of received lines (without their prefix character),
+filled by the reader task. When full the oldest line is dropped and
+counted in `dropped`.
+
+Consumers either `take!` (blocks until a line arrives), `wait` for a
+notification, or register a callback with `on_line!`.
+"""
+mutable struct LineRing
+    bytes::Matrix{UInt8}                # LINE_MAX × capacity
+    lengths::Vector{Int}
+    first::Int                          # Slot of oldest line.
+    count::Int
+    dropped::Int
+    ready::Condition
+    callback::Union{Nothing,Function}
+end
+
+LineRing(capacity) = LineRing(Matrix{UInt8}(undef, LINE_MAX, capacity),
+                              zeros(Int, capacity), 1, 0, 0, Condition(),
+                              nothing)
+
+capacity(r::LineRing) = length(r.lengths)
+Base.isempty(r::LineRing) = r.count == 0
+Base.length(r::LineRing) = r.count
+Base.empty!(r::LineRing) = (r.count = 0; r)
+Base.wait(r::LineRing) = wait(r.ready)
+
+"""
+    on_line!(f, r::LineRing)
+
+Call `f(line, n)` from the reader task for each line instead of buffering
+it. `line[1:n]` is only valid during the call. `f = nothing` restores
+buffering.
+"""
+on_line!(f, r::LineRing) = (r.callback = f; nothing)
+
+# Store `line[2:n]` (no allocation).
+function ring_put!(r::LineRing, line::Vector{UInt8}, n::Int)
+    if r.callback !== nothing
+        r.callback(view(line, 2:n), n - 1)
+        return
+    end
+    if r.count == capacity(r)
+        r.first = r.first % capacity(r) + 1
+        r.count -= 1
+        r.dropped += 1
+    end
+    slot = (r.first + r.count - 1) % capacity(r) + 1
+    @inbounds for i in 2:n
+        r.bytes[i - 1, slot] = line[i]
+    end
+    r.lengths[slot] = n - 1
+    r.count += 1
+    notify(r.ready)
+    nothing
+end
+
+function Base.take!(r::LineRing)
+    while isempty(r)
+        wait(r.ready)
+    end
+    slot = r.first
+    line = String(r.bytes[1:r.lengths[slot], slot])
+    r.first = r.first % capacity(r) + 1
+    r.count -= 1
+    line
+end
+
+empty_channel!(r::LineRing) = (empty!(r); nothing)
+
+
+
 # GPIO Interface.
 
 struct MegaGPIO
 
     port::String
     io::IO
-    response::Channel{String}
-    monitor::Channel{String}
-    usarts::Vector{Channel{String}}
+    response::LineRing
+    monitor::LineRing
+    data::LineRing
+    telemetry::LineRing
+    usarts::Vector{LineRing}
+    reader::Ref{Task}
+    received::Condition                 # Notified for every line.
+    lock::ReentrantLock                 # One command at a time.
 
     @db function MegaGPIO(port)
 
@@ -60,11 +143,10 @@ struct MegaGPIO
         sleep(1)
         UnixIO.tcflush(io, C.TCIOFLUSH)
 
-        response = Channel{String}(1000)
-        monitor = Channel{String}(1000)
-        usarts = [Channel{String}(1000) for i in 1:3]
-
-        m = new(port, io, response, monitor, usarts)
+        m = new(port, io, LineRing(16), LineRing(1024), LineRing(1024),
+                LineRing(256), [LineRing(256) for i in 1:3], Ref{Task}(),
+                Condition(), ReentrantLock())
+        m.reader[] = @async reader_task(m)
         @db "Opened MegaGPIO on $port"
         reset(m)
         @db return m
@@ -74,8 +156,6 @@ end
 Base.close(m::MegaGPIO) = close(m.io)
 Base.isopen(m::MegaGPIO) = isopen(m.io)
 
-isfull(c::Channel) = length(c.data) ≥ c.sz_max
-
 status(m::MegaGPIO) = PiAVRDude.status(m.avr.isp)
 
 
@@ -86,70 +166,100 @@ status(m::MegaGPIO) = PiAVRDude.status(m.avr.isp)
     nothing
 end
 
-@db function recv_response(m)
 
-    line = readline(m.io)
-    while isempty(line) && isopen(m.io)
-        line = readline(m.io)
-    end
-    if !isopen(m.io)
+"""
+Read lines continuously and demultiplex them by prefix character into
+the line rings. Runs until the port is closed; errors are passed on to
+anyone waiting for a line. The steady-state path does not allocate.
+"""
+function reader_task(m::MegaGPIO)
+    buf = Vector{UInt8}(undef, 4096)
+    line = Vector{UInt8}(undef, LINE_MAX + 1)
+    n = 0
+    try
+        while isopen(m.io)
+            count = readbytes!(m.io.in, buf, length(buf); all = false)
+            for i in 1:count
+                c = @inbounds buf[i]
+                if c == UInt8('\r') || c == UInt8('\n')
+                    n > 0 && dispatch_line(m, line, n)
+                    n = 0
+                elseif n ≤ LINE_MAX
+                    n += 1
+                    @inbounds line[n] = c
+                end
+            end
+        end
         throw(EOFError())
+    catch err
+        for r in (m.response, m.monitor, m.data, m.telemetry, m.usarts...)
+            notify(r.ready, err; error = true)
+        end
+        notify(m.received, err; error = true)
+        err isa EOFError || @error "MegaGPIO reader failed" exception = err
     end
+end
 
-    @assert !isempty(line)
-
+function dispatch_line(m::MegaGPIO, line, n)
     c = line[1]
-    channel = if c == '>' m.response
-          elseif c == '!' m.monitor
-          elseif c == '1' m.usarts[1]
-          elseif c == '2' m.usarts[2]
-          elseif c == '3' m.usarts[3]
-            else
-                @db "MegaGPIO ==> \"$line\""
-                return
-            end
-
-    @db "MegaGPIO ==> \"$line\""
-    @assert !isfull(channel)
-    put!(channel, line[2:end])
-
+    r = c == UInt8('>') ? m.response :
+        c == UInt8('!') ? m.monitor :
+        c == UInt8('#') ? m.data :
+        c == UInt8('~') ? m.telemetry :
+        c == UInt8('1') ? m.usarts[1] :
+        c == UInt8('2') ? m.usarts[2] :
+        c == UInt8('3') ? m.usarts[3] : nothing
+    if r !== nothing
+        ring_put!(r, line, n)
+    end
+    notify(m.received)
     nothing
 end
 
 
-@db function empty_channel!(c::Channel)
-    while !isempty(c)
-        take!(c)
-    end
-    nothing
-end
+"""
+Wait for the reader task to receive another line.
+"""
+recv_response(m::MegaGPIO) = (wait(m.received); nothing)
+
+
+"""
+    on_monitor(f, m)
+
+Call `f(line, n)` for each monitor event as it arrives, see `on_line!`.
+"""
+on_monitor(f, m::MegaGPIO) = on_line!(f, m.monitor)
 
 
 @db function reset(m)
     empty_channel!(m.response)
     send_command(m, "Z")
-    while isempty(m.response)
-        recv_response(m)
-    end
     result = take!(m.response)
     @assert result == "Z"
     empty_channel!(m.monitor)
+    empty_channel!(m.data)
+    empty_channel!(m.telemetry)
     for u in m.usarts
         empty_channel!(u)
     end
 end
 
-@db function command(m::MegaGPIO, command)
-    send_command(m, command)
-    while isempty(m.response)
-        recv_response(m)
-    end
-    result = take!(m.response)                                    ;@db 3 result
+@db function command_response(m::MegaGPIO, command)
+    result = lock(m.lock) do
+        send_command(m, command)
+        take!(m.response)
+    end                                    ;@db 3 result
     @assert startswith(result, "$command")
-    value = result[length(command)+1:end]
+    @db return result[length(command)+1:end]
+end
+
+@db function command(m::MegaGPIO, command)
+    value = command_response(m, command)
     @db return isempty(value) ? nothing : parse(Int, value; base = 16)
 end
 
+hex(x, n) = string(x; base = 16, pad = n)
+
 
 output_low(m, pin) = (command(m, "L$pin"); nothing)
 output_high(m, pin) = (command(m, "H$pin"); nothing)
@@ -172,6 +282,33 @@ Base.getindex(m::MegaGPIO, pin) = read_input(m, pin)
 
 
 
+# Snapshot Interface.
+
+const snapshot_ports = "ABCDEFGHJKL"
+
+"""
+    snapshot(m)
+
+Read every port and ADC channel with one command.
+Returns `(time_ms, ports, adc)` where `ports['A']` is
+`(pin, ddr, port, monitor)` and `adc[1:16]` is channels F0-F7, K0-K7.
+"""
+@db function snapshot(m::MegaGPIO)
+    v = command_response(m, "P")
+    h(i, n) = parse(Int, v[i:i+n-1]; base = 16)
+    time_ms = h(1, 8)
+    ports = Dict{Char,NamedTuple}()
+    for (i, c) in enumerate(snapshot_ports)
+        o = 9 + (i - 1) * 8
+        ports[c] = (pin = h(o, 2), ddr = h(o + 2, 2),
+                    port = h(o + 4, 2), monitor = h(o + 6, 2))
+    end
+    o = 9 + length(snapshot_ports) * 8
+    adc = [h(o + (i - 1) * 3, 3) for i in 1:16]
+    @db return (time_ms = time_ms, ports = ports, adc = adc)
+end
+
+
 # ADC Interface.
 
 struct MegaADC
@@ -181,6 +318,716 @@ end
 Base.getindex(m::MegaADC, pin) = command(m.gpio, "A$pin")
 
 
+# Input Capture Interface.
+
+const F_CPU = 16_000_000
+
+"""
+    MegaCapture(gpio, timer)
+
+Frequency, period, duty cycle and edge count measurement.
+
+`timer` 1, 3, 4, 5: Input Capture on ICPn (`:period` or `:width` mode).
+`timer` 0, 1, 5: External clock counting on Tn (`:count` mode).
+
+Periodic reports arrive on the monitor channel as `"C<timer><result>"`,
+see `parse_capture_result`.
+"""
+struct MegaCapture
+    gpio::MegaGPIO
+    timer::UInt8
+end
+
+const capture_modes = Dict(:period => 'P', :width => 'W', :count => 'T')
+
+start(c::MegaCapture, mode=:period) =
+    (command(c.gpio, "C$(capture_modes[mode])$(c.timer)"); nothing)
+stop(c::MegaCapture) = (command(c.gpio, "CX$(c.timer)"); nothing)
+stream(c::MegaCapture, ms) =
+    (command(c.gpio, "CS$(c.timer)$(hex(ms, 4))"); nothing)
+
+"""
+Frequency (Hz), mean period (s), duty cycle (0-1) and rising edge count
+since the previous result.
+"""
+parse_capture_result(s) = (
+    frequency = parse(UInt32, s[1:8]; base = 16) / 100,
+    period = parse(UInt32, s[9:16]; base = 16) / F_CPU,
+    duty = parse(UInt16, s[17:20]; base = 16) / 65536,
+    edges = Int(parse(UInt32, s[21:28]; base = 16)))
+
+Base.read(c::MegaCapture) =
+    parse_capture_result(command_response(c.gpio, "CR$(c.timer)"))
+
+
+# Output Sequencer Interface.
+
+"""
+    upload_sequence(m, steps)
+
+Replace the on-device output sequence with `steps`, a list of
+`(delay_us, port::Char, mask, value)` tuples. Each step waits `delay_us`
+(0 or ≥ 10 us, 0.5 us resolution) then sets the `mask` bits of `port` to
+`value`. Sequenced pins become outputs.
+"""
+@db function upload_sequence(m::MegaGPIO, steps)
+    command(m, "SC")
+    for (delay_us, port, mask, value) in steps
+        command(m, "SA$(hex(delay_us, 8))$port$(hex(mask, 2))$(hex(value, 2))")
+    end
+    nothing
+end
+
+"""
+    start_sequence(m; loops=1)
+
+Play the uploaded sequence `loops` times (0 = forever).
+`"SD"` is sent to the monitor channel when it finishes.
+"""
+start_sequence(m::MegaGPIO; loops=1) =
+    (command(m, loops == 1 ? "SG" : "SL$(hex(loops, 4))"); nothing)
+stop_sequence(m::MegaGPIO) = (command(m, "SX"); nothing)
+
+function sequence_status(m::MegaGPIO)
+    v = command_response(m, "SQ")
+    (running = v[1:2] != "00",
+     step = parse(Int, v[3:4]; base = 16),
+     length = parse(Int, v[5:6]; base = 16))
+end
+
+
+# Stepper Motion Interface.
+
+"""
+    stepper_config(m, axis, dir_pin)
+
+Set the direction pin of stepper `axis` (0 or 1), e.g. `"B0"` (high =
+reverse). Axis 0 steps on pin 6 (PH3), axis 1 on pin 7 (PH4).
+"""
+stepper_config(m::MegaGPIO, axis, dir_pin) =
+    (command(m, "KC$axis$dir_pin"); nothing)
+
+"""
+    stepper_move(m, axis, steps; rate, accel)
+
+Queue a move of `steps` (negative = reverse) at up to `rate` steps/s
+(32-40000) with acceleration `accel` steps/s² (up to 1048575). Each move
+starts and ends at rest. `"K<axis><position>"` is sent to the monitor
+channel when a move ends.
+"""
+stepper_move(m::MegaGPIO, axis, steps; rate, accel) =
+    (command(m, "KM$axis$(hex(reinterpret(UInt32, Int32(steps)), 8))" *
+                "$(hex(rate, 4))$(hex(accel, 6))"); nothing)
+
+"""
+    stepper_stop(m, axis)
+
+Drop queued moves and decelerate `axis` to a stop.
+"""
+stepper_stop(m::MegaGPIO, axis) = (command(m, "KS$axis"); nothing)
+
+"""
+    stepper_abort(m)
+
+Stop both axes at once (steps may be lost) and drop queued moves.
+"""
+stepper_abort(m::MegaGPIO) = (command(m, "KX"); nothing)
+
+set_stepper_position(m::MegaGPIO, axis, position) =
+    (command(m, "KP$axis$(hex(reinterpret(UInt32, Int32(position)), 8))");
+     nothing)
+
+function stepper_status(m::MegaGPIO, axis)
+    v = command_response(m, "KQ$axis")
+    (running = v[1:2] != "00",
+     position = reinterpret(Int32, parse(UInt32, v[3:10]; base = 16)),
+     queued = parse(Int, v[11:12]; base = 16))
+end
+
+# Reflex Rule Interface.
+
+"""
+    set_reflex(m, i, pin, edge, port, mask, value; debounce_ms=0, delay_ms=0)
+
+Rule `i` (0-7): when input `pin` (e.g. `"A3"`) goes `edge` (`:H` or `:L`)
+and stays there for `debounce_ms`, wait `delay_ms` then set the `mask` bits
+of output `port` (e.g. `'B'`) to `value`.
+The firmware reacts locally and sends `"R<i><edge>"` to the monitor channel.
+Inputs on pins with an interrupt (Port B, PD0-3, PE0, PE4-7, PJ0-6) act
+within microseconds when there is no debounce or delay, other pins within
+1 ms.
+"""
+@db function set_reflex(m::MegaGPIO, i, pin, edge, port, mask, value;
+                        debounce_ms=0, delay_ms=0)
+    @assert edge in (:H, :L)
+    command(m, "RS$(hex(i, 1))$pin$edge$(hex(debounce_ms, 2))" *
+               "$(hex(delay_ms, 4))$port$(hex(mask, 2))$(hex(value, 2))")
+    nothing
+end
+
+clear_reflex(m::MegaGPIO, i) = (command(m, "RX$(hex(i, 1))"); nothing)
+clear_reflexes(m::MegaGPIO) = (command(m, "RC"); nothing)
+
+
+# Quadrature Encoder Interface.
+
+"""
+    MegaEncoder(gpio, channel)
+
+Quadrature encoder decoded by the firmware on Port K pin change
+interrupts. Reports arrive on the monitor channel as
+`"E<channel><position:8><velocity:8>"`, see `parse_encoder_result`.
+"""
+struct MegaEncoder
+    gpio::MegaGPIO
+    channel::UInt8
+end
+
+"""
+    start(e::MegaEncoder, a, b, index=nothing)
+
+Decode Port K pins `a` and `b` (0-7). Optional `index` pin zeros the
+position on its rising edge.
+"""
+start(e::MegaEncoder, a, b, index=nothing) =
+    (command(e.gpio, "EE$(e.channel)$a$b$(index === nothing ? '-' : index)");
+     nothing)
+stop(e::MegaEncoder) = (command(e.gpio, "EX$(e.channel)"); nothing)
+zero!(e::MegaEncoder) = (command(e.gpio, "EZ$(e.channel)"); nothing)
+stream(e::MegaEncoder, ms) =
+    (command(e.gpio, "ES$(e.channel)$(hex(ms, 4))"); nothing)
+
+"""
+Position (counts) and velocity (counts per second).
+"""
+parse_encoder_result(s) = (
+    position = Int(reinterpret(Int32, parse(UInt32, s[1:8]; base = 16))),
+    velocity = Int(reinterpret(Int32, parse(UInt32, s[9:16]; base = 16))))
+
+"""
+    read(e::MegaEncoder)
+
+Position, velocity and `errors`, the count of invalid transitions (A and B
+changed together, e.g. pulses faster than the pin change ISR).
+"""
+function Base.read(e::MegaEncoder)
+    s = command_response(e.gpio, "ER$(e.channel)")
+    merge(parse_encoder_result(s), (errors = parse(Int, s[17:20]; base = 16),))
+end
+
+
+# Logic Analyzer Interface.
+
+const logic_triggers = Dict(:none => 'N', :level => 'P', :edge => 'E')
+
+"""
+    logic_capture(m, ports; rate, trigger=:none, mask=0, value=0,
+                  pre=0, post=1000)
+
+Sample `ports` (`"A"` or two ports e.g. `"AC"`) at `rate` samples per
+second (≤ 400 kHz, less for two ports) into the firmware capture buffer, then download it.
+
+`trigger` `:level` starts when `(sample & mask) == value`,
+`:edge` when `(sample & mask)` becomes equal to `value`.
+`pre` samples before and `post` samples after the trigger are kept.
+
+Returns `(samples, trigger, period)`, `samples[trigger]` is the trigger
+sample. Throws an error if the firmware could not sample at `rate` (the
+sample times would not be `period` apart). The firmware is unresponsive until the trigger occurs (sending
+any command aborts the capture).
+"""
+@db function logic_capture(m::MegaGPIO, ports; rate, trigger=:none,
+                           mask=0, value=0, pre=0, post=1000)
+    @assert length(ports) in (1, 2)
+    ticks = round(Int, F_CPU / rate)
+    p = length(ports) == 1 ? "$(ports)-" : ports
+    v = command_response(m, "WC$p$(hex(ticks, 4))$(logic_triggers[trigger])" *
+                            "$(hex(mask, 4))$(hex(value, 4))" *
+                            "$(hex(pre, 4))$(hex(post, 4))")
+    n = parse(Int, v[1:4]; base = 16)
+    if v[9:10] != "00"
+        error("Logic capture overrun: $rate samples/s is too fast for " *
+              "$(length(ports) * 8) channels.")
+    end
+    samples = logic_download(m, length(ports) * 2)
+    @assert length(samples) == n
+    @db return (samples = samples, trigger = pre + 1, period = ticks / F_CPU)
+end
+
+@db function logic_download(m::MegaGPIO, digits)
+    empty_channel!(m.data)
+    n = parse(Int, command_response(m, "WDR"); base = 16)
+    samples = UInt16[]
+    while !isempty(m.data)
+        line = take!(m.data)
+        for i in 1:(2 + digits):length(line)
+            count = parse(Int, line[i:i+1]; base = 16)
+            sample = parse(UInt16, line[i+2:i+1+digits]; base = 16)
+            append!(samples, fill(sample, count))
+        end
+    end
+    @db return samples
+end
+
+
+# Analog Monitor Interface.
+
+"""
+    set_analog_monitor(m, channel; low, high, hysteresis=0)
+
+Scan ADC `channel` (0-7 = F0-F7, 8-15 = K0-K7) in the background and
+report threshold crossings to the monitor channel as
+`"V<channel><state><value:3><ms:8>"`, see `parse_analog_event`.
+"""
+set_analog_monitor(m::MegaGPIO, channel; low, high, hysteresis=0) =
+    (command(m, "VS$(hex(channel, 1))$(hex(low, 3))$(hex(high, 3))" *
+                "$(hex(hysteresis, 3))"); nothing)
+clear_analog_monitor(m::MegaGPIO, channel) =
+    (command(m, "VX$(hex(channel, 1))"); nothing)
+clear_analog_monitors(m::MegaGPIO) = (command(m, "VC"); nothing)
+
+"""
+`state` is `:L` (below low), `:N` (inside window) or `:H` (above high).
+"""
+parse_analog_event(s) = (
+    channel = parse(Int, s[2:2]; base = 16),
+    state = Symbol(s[3]),
+    value = parse(Int, s[4:6]; base = 16),
+    time_ms = parse(Int, s[7:14]; base = 16))
+
+function read_analog_monitor(m::MegaGPIO, channel)
+    v = command_response(m, "VR$(hex(channel, 1))")
+    (state = Symbol(v[1]), value = parse(Int, v[2:4]; base = 16))
+end
+
+
+# ADC Telemetry Interface.
+
+"""
+    MegaTelemetry(gpio, channels; period_ms, block=16, delta=channels)
+
+Compressed ADC sample stream. `channels` (0-7 = F0-F7, 8-15 = K0-K7) are
+sampled every `period_ms` and sent `block` sample sets per line.
+Channels in `delta` are sent as zig-zag varint deltas from the previous
+sample, other channels as packed 10-bit values.
+See `telemetry.h` for the wire format.
+"""
+struct MegaTelemetry
+    gpio::MegaGPIO
+    channels::Vector{Int}
+    delta::Vector{Bool}
+    period_ms::Int
+    block::Int
+end
+
+function MegaTelemetry(gpio, channels; period_ms, block=16, delta=channels)
+    channels = sort(collect(channels))
+    mask(c) = reduce(|, (1 << i for i in c); init = 0)
+    command(gpio, "TS$(hex(mask(channels), 4))$(hex(period_ms, 4))" *
+                  "$(hex(block, 2))$(hex(mask(delta), 4))")
+    MegaTelemetry(gpio, channels, [c in delta for c in channels],
+                  period_ms, block)
+end
+
+stop(t::MegaTelemetry) = (command(t.gpio, "TX"); nothing)
+
+
+mutable struct TelemetryBits
+    line::String
+    i::Int
+end
+
+function read_bits(b::TelemetryBits, n)
+    v = 0
+    for _ in 1:n
+        c = codeunit(b.line, b.i ÷ 6 + 1) - UInt8('0')
+        v = (v << 1) | ((c >> (5 - b.i % 6)) & 1)
+        b.i += 1
+    end
+    v
+end
+
+function read_varint(b::TelemetryBits)
+    v = 0
+    shift = 0
+    while true
+        g = read_bits(b, 4)
+        v |= (g & 7) << shift
+        shift += 3
+        g & 8 == 0 && return v
+    end
+end
+
+unzigzag(v) = (v >>> 1) ⊻ -(v & 1)
+
+"""
+    decode_telemetry(t::MegaTelemetry, line)
+
+Decode one telemetry line (without the "~" prefix).
+Returns `(times_ms, samples)`, `samples[set, k]` is `t.channels[k]`.
+Only `t.channels`, `t.delta` and `t.period_ms` are used, so `t` can be
+any object with those fields (see `test/runtests.jl`).
+"""
+function decode_telemetry(t, line)
+    b = TelemetryBits(line, 0)
+    time = read_bits(b, 32)
+    count = read_bits(b, 8)
+    n = length(t.channels)
+    samples = zeros(Int, count, n)
+    for set in 1:count, k in 1:n
+        samples[set, k] = if set == 1 || !t.delta[k]
+            read_bits(b, 10)
+        else
+            samples[set - 1, k] + unzigzag(read_varint(b))
+        end
+    end
+    times = [time + (i - 1) * t.period_ms for i in 1:count]
+    times, samples
+end
+
+@db function Base.take!(t::MegaTelemetry)
+    @db return decode_telemetry(t, take!(t.gpio.telemetry))
+end
+
+
+# SPI Master Interface.
+
+const SPI_BUFFER_SIZE = 64
+
+"""
+    MegaSPI(gpio; mode=0, clock_div=16, lsb_first=false, cs="B0")
+
+SPI master on the hardware SPI pins (SCK = B1, MOSI = B2, MISO = B3) with
+chip select pin `cs`. `clock_div` is 2, 4, 8 ... 128 (`F_CPU / 2` = 8 MHz).
+At `clock_div` ≥ 16 the firmware transfers in the background.
+"""
+struct MegaSPI
+    gpio::MegaGPIO
+end
+
+@db function MegaSPI(gpio::MegaGPIO; mode=0, clock_div=16, lsb_first=false,
+                                     cs="B0")
+    @assert mode in 0:3
+    @assert ispow2(clock_div) && 2 <= clock_div <= 128
+    clock = trailing_zeros(clock_div) - 1
+    command(gpio, "XC$mode$clock$(lsb_first ? 'L' : 'M')$cs")
+    MegaSPI(gpio)
+end
+
+stop(s::MegaSPI) = (command(s.gpio, "XX"); nothing)
+
+"""
+    transfer(s::MegaSPI, bytes) -> Vector{UInt8}
+
+Send `bytes` with chip select low and return the bytes read from MISO.
+Transfers longer than `SPI_BUFFER_SIZE` are split into several commands
+without releasing chip select.
+"""
+@db function transfer(s::MegaSPI, bytes::AbstractVector{UInt8})
+    @assert !isempty(bytes)
+    rx = Vector{UInt8}(undef, length(bytes))
+    chunks = Iterators.partition(eachindex(bytes), SPI_BUFFER_SIZE)
+    for (i, r) in enumerate(chunks)
+        c = i == length(chunks) ? 'T' : 'K'
+        v = command_response(s.gpio, "X$c$(uppercase(bytes2hex(bytes[r])))")
+        rx[r] = hex2bytes(v)
+    end
+    @db return rx
+end
+
+
+# TWI (I2C) Master Interface.
+
+const TWI_BUFFER_SIZE = 32
+
+const TWI_ERRORS = [:address_nack, :data_nack, :arbitration_lost,
+                    :bus_error, :timeout]
+
+"""
+    MegaTWI(gpio; khz=100)
+
+I2C master on SCL = D0, SDA = D1 at `khz` (8-400) kHz.
+Failed transactions throw `TWIError`.
+"""
+struct MegaTWI
+    gpio::MegaGPIO
+end
+
+struct TWIError <: Exception
+    address::Int
+    error::Symbol
+end
+
+@db function MegaTWI(gpio::MegaGPIO; khz=100)
+    command(gpio, "YC$(hex(khz, 4))")
+    MegaTWI(gpio)
+end
+
+stop(t::MegaTWI) = (command(t.gpio, "YX"); nothing)
+
+"""
+    transaction(t, address, tx, n) -> Vector{UInt8}
+
+Write `tx` to 7-bit `address` then (repeated START) read `n` bytes,
+as one firmware command.
+"""
+@db function transaction(t::MegaTWI, address, tx::AbstractVector{UInt8}, n)
+    @assert length(tx) <= TWI_BUFFER_SIZE && n <= TWI_BUFFER_SIZE
+    v = command_response(t.gpio,
+        "YT$(uppercase(hex(address, 2) * hex(n, 2) * bytes2hex(tx)))")
+    status = parse(Int, v[1:2]; base = 16)
+    status == 0 || throw(TWIError(address, TWI_ERRORS[status]))
+    @db return hex2bytes(v[3:end])
+end
+
+"""
+    read_registers(t, address, register, n) -> Vector{UInt8}
+
+Burst read `n` registers starting at `register`.
+"""
+read_registers(t::MegaTWI, address, register, n) =
+    transaction(t, address, UInt8[register], n)
+
+"""
+    write_registers(t, address, register, bytes)
+
+Burst write `bytes` to registers starting at `register`.
+"""
+write_registers(t::MegaTWI, address, register, bytes) =
+    (transaction(t, address, UInt8[register; bytes], 0); nothing)
+
+"""
+    scan(t) -> Vector{Int}
+
+Addresses (0x08-0x77) of the devices that ACK.
+"""
+@db function scan(t::MegaTWI)
+    v = command_response(t.gpio, "YS")
+    status = parse(Int, v[1:2]; base = 16)
+    status == 0 || throw(TWIError(0, TWI_ERRORS[status]))
+    found = hex2bytes(v[3:end])
+    @db return [a for a in 0:127 if found[(a >> 3) + 1] & (1 << (a & 7)) != 0]
+end
+
+
+# Profiling Interface.
+
+const PROFILE_PROBES = [
+    :pass,
+    :command_gpio, :command_usart, :command_capture, :command_sequence,
+    :command_reflex, :command_encoder, :command_logic, :command_analog,
+    :command_telemetry, :command_snapshot, :command_spi,
+    :command_twi, :command_jobs, :command_routes, :command_stepper,
+    :isr_usart0_rx, :isr_usart0_tx, :isr_usart1_rx, :isr_usart1_tx,
+    :isr_usart2_rx, :isr_usart2_tx, :isr_usart3_rx, :isr_usart3_tx,
+    :isr_timer2, :isr_capture, :isr_sequence, :isr_encoder, :isr_adc,
+    :isr_spi, :isr_twi, :isr_stepper, :isr_stepper_plan, :isr_reflex]
+
+const PROFILE_FIFOS = [
+    :usart0_rx, :usart0_tx, :usart1_rx, :usart1_tx,
+    :usart2_rx, :usart2_tx, :usart3_rx, :usart3_tx]
+
+"""
+    profile_stats(m)
+
+Read timing stats from firmware built with `-DPROFILE`.
+Returns `(probes, fifos)`: per probe `count`, `min`, `max`, `mean` (CPU
+cycles) and `histogram` (counts below 64, 256, 1K, 4K, 16K, 64K, 256K
+cycles and above); per FIFO `size` and `peak` fill level.
+"""
+@db function profile_stats(m::MegaGPIO)
+    empty_channel!(m.data)
+    command_response(m, "QR")
+    probes = Dict{Symbol,Any}()
+    fifos = Dict{Symbol,Any}()
+    h(line, i, n) = parse(Int, line[i:i+n-1]; base = 16)
+    while !isempty(m.data)
+        line = take!(m.data)
+        if line[1] == 'P'
+            probes[PROFILE_PROBES[h(line, 2, 2) + 1]] = (
+                count = h(line, 4, 4),
+                min = h(line, 8, 8),
+                max = h(line, 16, 8),
+                mean = h(line, 24, 8),
+                histogram = [h(line, 32 + 4i, 4) for i in 0:7])
+        elseif line[1] == 'F'
+            fifos[PROFILE_FIFOS[h(line, 2, 1) + 1]] = (
+                size = h(line, 3, 2),
+                peak = h(line, 5, 2))
+        end
+    end
+    @db return (probes = probes, fifos = fifos)
+end
+
+clear_profile_stats(m::MegaGPIO) = (command_response(m, "QC"); nothing)
+
+
+# Flight Recorder Interface.
+
+"""
+    flight_record(m)
+
+Read the firmware's flight recorder, which survives the watchdog reset
+after an error. Returns `(reset_cause, error, entries)`: `reset_cause`
+is MCUSR at boot (8 = watchdog), `error` is `nothing` or
+`(pc, time_ms, message)` of the last error, `entries` are the last
+commands (`:command`) and events (`:event`) as `(time_ms, kind, text)`,
+oldest first. Long commands and events are truncated.
+"""
+@db function flight_record(m::MegaGPIO)
+    empty_channel!(m.data)
+    command_response(m, "FR")
+    h(line, i, n) = parse(Int, line[i:i+n-1]; base = 16)
+    reset_cause = 0
+    error = nothing
+    entries = []
+    while !isempty(m.data)
+        line = take!(m.data)
+        if line[1] == 'R'
+            reset_cause = h(line, 2, 2)
+            if line[4] == '1'
+                error = (pc = h(line, 5, 4), time_ms = h(line, 9, 8),
+                         message = line[17:end])
+            end
+        elseif line[1] == 'E'
+            push!(entries, (time_ms = h(line, 2, 8),
+                            kind = line[10] == 'C' ? :command : :event,
+                            text = line[11:end]))
+        end
+    end
+    @db return (reset_cause = reset_cause, error = error, entries = entries)
+end
+
+clear_flight_record(m::MegaGPIO) = (command_response(m, "FC"); nothing)
+
+
+
+# Memory Usage Interface.
+
+const SRAM_BUFFERS = [
+    :usart_fifos,
+    :usart0_line, :usart1_line, :usart2_line, :usart3_line,
+    :logic, :telemetry, :sequence, :spi, :twi, :modbus, :recorder, :jobs,
+    :stepper]
+
+"""
+    memory_stats(m)
+
+Read the firmware's SRAM budget (bytes). Returns `(static, stack,
+stack_peak, buffers)`: `static` is .data + .bss + .noinit, `stack` is the
+SRAM left for the stack, `stack_peak` the most stack used since reset and
+`buffers` the size of each large static buffer. `stack_peak` close to
+`stack` means the stack is about to overwrite static data.
+All zero except `buffers` on the host build.
+"""
+@db function memory_stats(m::MegaGPIO)
+    empty_channel!(m.data)
+    r = command_response(m, "GS")
+    h(line, i, n) = parse(Int, line[i:i+n-1]; base = 16)
+    buffers = Dict{Symbol,Int}()
+    while !isempty(m.data)
+        line = take!(m.data)
+        if line[1] == 'M'
+            buffers[SRAM_BUFFERS[h(line, 2, 2) + 1]] = h(line, 4, 4)
+        end
+    end
+    @db return (static = h(r, 1, 4), stack = h(r, 5, 4),
+                stack_peak = h(r, 9, 4), buffers = buffers)
+end
+
+"""
+    fifo_sizes(m)
+
+USART FIFO sizes in use, as `[rx0, tx0, rx1, tx1, rx2, tx2, rx3, tx3]`
+(0 = USART unused), the size of the FIFO arena they share and the bytes
+of it in use.
+"""
+@db function fifo_sizes(m::MegaGPIO)
+    r = command_response(m, "GF")
+    @db return (sizes = [parse(Int, r[i:i+1]; base = 16) for i in 1:2:15],
+                arena = parse(Int, r[17:20]; base = 16),
+                used = parse(Int, r[21:24]; base = 16))
+end
+
+"""
+    set_fifo_sizes(m, sizes)
+
+Save USART FIFO sizes `[rx0, tx0, rx1, tx1, rx2, tx2, rx3, tx3]` in the
+board's EEPROM. They take effect at the next reset. Each size is 0 (both
+FIFOs of a USART, to leave it unused) or 2-255, USART0 needs at least 16
+and the total must fit the arena.
+"""
+function set_fifo_sizes(m::MegaGPIO, sizes)
+    @assert length(sizes) == 8
+    command_response(m, "GF" * join(hex(s, 2) for s in sizes))
+    nothing
+end
+
+
+
+# Multi-board Interface.
+
+struct MegaEvent
+    time_ns::UInt64                     # Host time of arrival.
+    board::Int
+    line::String
+end
+
+"""
+    MegaManager(ports; events=10_000)
+
+Open several boards at once. Each board's reader task runs on the one
+Julia event loop, so a slow board does not hold up the others, and
+commands to different boards can be issued concurrently (`commands`,
+`broadcast_command`).
+
+Monitor events from all boards are merged into `events` as `MegaEvent`s
+in order of arrival. If `events` is full the oldest event is dropped and
+counted in `dropped`.
+"""
+struct MegaManager
+    boards::Vector{MegaGPIO}
+    events::Channel{MegaEvent}
+    dropped::Ref{Int}
+end
+
+@db function MegaManager(ports; events=10_000)
+    boards = Vector{MegaGPIO}(undef, length(ports))
+    @sync for (i, port) in enumerate(ports)
+        @async boards[i] = MegaGPIO(port)
+    end
+    mgr = MegaManager(boards, Channel{MegaEvent}(events), Ref(0))
+    for (i, board) in enumerate(boards)
+        on_monitor(board) do line, n
+            if Base.n_avail(mgr.events) ≥ events
+                take!(mgr.events)
+                mgr.dropped[] += 1
+            end
+            put!(mgr.events, MegaEvent(time_ns(), i, String(line)))
+        end
+    end
+    @db return mgr
+end
+
+Base.getindex(mgr::MegaManager, i) = mgr.boards[i]
+Base.length(mgr::MegaManager) = length(mgr.boards)
+Base.close(mgr::MegaManager) = (foreach(close, mgr.boards); close(mgr.events))
+Base.take!(mgr::MegaManager) = take!(mgr.events)
+
+"""
+    commands(mgr, cmds)
+
+Send `cmds[i]` to board `i`, all boards concurrently.
+Returns the response values.
+"""
+commands(mgr::MegaManager, cmds) =
+    asyncmap(((board, cmd),) -> command_response(board, cmd),
+             zip(mgr.boards, cmds))
+
+broadcast_command(mgr::MegaManager, cmd) =
+    commands(mgr, fill(cmd, length(mgr)))
+
+
 # USART Interface.
 
 struct MegaUSART
@@ -194,12 +1041,82 @@ Base.isempty(m::MegaUSART) = isempty(rx_channel(m))
 Base.empty!(m::MegaUSART) = empty_channel!(rx_channel(m))
 Base.write(m::MegaUSART, x) = (command(m.gpio, "$(m.id)$x") ; nothing)
 
-@db function Base.take!(m::MegaUSART) 
-    c = rx_channel(m)
-    while isempty(c)
-        recv_response(m.gpio)
-    end
-    @db return take!(c)
+Base.take!(m::MegaUSART) = take!(rx_channel(m))
+
+"""
+    on_receive(f, u::MegaUSART)
+
+Call `f(line, n)` for each line received on the USART, see `on_line!`.
+"""
+on_receive(f, m::MegaUSART) = on_line!(f, rx_channel(m))
+
+
+
+# USART Polling Job Interface.
+
+"""
+    set_poll_job(u::MegaUSART, job, period_ms, query; always=false)
+
+Send `query` (with CR LF) on the USART every `period_ms`, on the board's
+clock. The next line received is the reply, reported on the monitor
+channel as `"J<job><time_ms:8><reply>"`, see `parse_poll_reply`.
+Unless `always`, a reply is only reported when it has changed.
+Jobs 0-3 are shared by all USARTs.
+"""
+@db function set_poll_job(u::MegaUSART, job, period_ms, query; always=false)
+    command(u.gpio,
+            "JS$(hex(job, 1))$(u.id)$(hex(period_ms, 4))$(always ? 'A' : 'C')" *
+            query)
+    nothing
+end
+
+clear_poll_job(m::MegaGPIO, job) = (command(m, "JX$(hex(job, 1))"); nothing)
+clear_poll_jobs(m::MegaGPIO) = (command(m, "JC"); nothing)
+
+"""
+Job number, time the query was sent (ms) and reply.
+"""
+parse_poll_reply(s) = (
+    job = parse(Int, s[2:2]; base = 16),
+    time_ms = parse(UInt32, s[3:10]; base = 16),
+    reply = s[11:end])
+
+
+
+# USART Routing Interface.
+
+"""
+    route(from::MegaUSART, to::MegaUSART; tap=false)
+
+Forward bytes received on `from` directly to `to` on the board.
+Routed bytes no longer arrive on `from`'s channel. With `tap` they are
+mirrored to the monitor channel as `"O<from><to><bytes:2n>"`.
+"""
+@db function route(from::MegaUSART, to::MegaUSART; tap=false)
+    @assert from.gpio === to.gpio
+    command(from.gpio, "OS$(from.id)$(to.id)$(tap ? 'T' : 'N')")
+    nothing
+end
+
+unroute(from::MegaUSART) = (command(from.gpio, "OX$(from.id)"); nothing)
+clear_routes(m::MegaGPIO) = (command(m, "OC"); nothing)
+
+
+
+# Modbus RTU Mode.
+
+"""
+    enable_modbus(m, address)
+
+Switch the board's serial port to Modbus RTU slave `address` (1-247)
+until it is reset. This interface no longer works after that; a Modbus
+master reads coils (PORTx bits), discrete inputs (PINx bits) and input
+registers (ADC, ms clock, encoder positions). See `modbus.h`.
+"""
+@db function enable_modbus(m::MegaGPIO, address)
+    @assert 1 <= address <= 247
+    command(m, "BM$(hex(address, 2))")
+    nothing
 end
 
 
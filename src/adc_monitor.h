@@ -0,0 +1,169 @@
+//==============================================================================
+// Analog Threshold and Window Monitors.
+//
+// Like `M` for pins, but for ADC channels. Each monitored channel is
+// scanned in the background and classified as 'L' (below low), 'N'
+// (inside the window) or 'H' (above high). A state is only left once the
+// value is `hysteresis` counts back inside the window.
+//
+// State changes are detected in the ADC ISR and reported from the main
+// loop as "!V<channel><state><value:3><ms:8>". Nothing is sent while the
+// state is stable.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef ADC_MONITOR_H_INCLUDED
+#define ADC_MONITOR_H_INCLUDED
+
+
+typedef struct {
+    uint16_t low;
+    uint16_t high;
+    uint16_t hysteresis;
+    uint8_t state;                  // 0 = off, '?' = no sample yet.
+    volatile bool pending;          // Event to report.
+    uint8_t event_state;
+    uint16_t event_value;
+    uint32_t event_time;
+} adc_monitor_t;
+
+
+static adc_monitor_t g_adc_monitor[16];
+static uint16_t g_adc_monitor_mask = 0;
+
+
+// Classify a new sample (called from ADC ISR).
+static void adc_monitor_sample(const uint8_t channel, const uint16_t value)
+{
+    adc_monitor_t* const m = &g_adc_monitor[channel];
+    if (m->state == 0) {
+        return;
+    }
+
+    uint8_t state = 'N';
+    if (value > m->high) {
+        state = 'H';
+    } else if (value < m->low) {
+        state = 'L';
+    }
+
+    if (m->state == 'H' && value + m->hysteresis >= m->high) {
+        state = 'H';
+    } else if (m->state == 'L' && value <= m->low + m->hysteresis) {
+        state = 'L';
+    }
+
+    if (state != m->state) {
+        m->state = state;
+        m->event_state = state;
+        m->event_value = value;
+        m->event_time = g_timer2_clock;
+        m->pending = true;
+    }
+}
+
+
+static void adc_monitor_poll(void)
+{
+    for (uint8_t i = 0 ; i < 16 ; i++) {
+        adc_monitor_t* const m = &g_adc_monitor[i];
+        if (!m->pending) {
+            continue;
+        }
+
+        uint8_t state;
+        uint16_t value;
+        uint32_t time;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            state = m->event_state;
+            value = m->event_value;
+            time = m->event_time;
+            m->pending = false;
+        }
+
+        print_c('!');
+        print_c('V');
+        print_hex_digit(i);
+        print_c(state);
+        print_hex_digit(value >> 8U);
+        print_hex(value & 0xFFU);
+        print_hex32(time);
+        print_end_of_line();
+    }
+}
+
+
+static void adc_monitor_disable(const uint8_t channel)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        g_adc_monitor[channel].state = 0;
+        g_adc_monitor[channel].pending = false;
+    }
+    g_adc_monitor_mask &= (uint16_t)~adc_channel_bit(channel);
+    adc_scan(ADC_SCAN_MONITOR, g_adc_monitor_mask);
+}
+
+
+
+/* Commands */
+
+// VS<channel:1><low:3><high:3><hysteresis:3>   Monitor channel 0-F.
+// VX<channel:1>                                Stop monitoring channel.
+// VC                                           Stop all monitors.
+// VR<channel:1>                                Read value and state.
+static void adc_monitor_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 2, "Short Analog Monitor Command!");
+    uint8_t channel = 0;
+    if (p[1] != 'C') {
+        assert(l >= 3, "Short Analog Monitor Command!");
+        channel = parse_hex_digit(p[2]);
+    }
+    adc_monitor_t* const m = &g_adc_monitor[channel];
+
+    switch(p[1]) {
+        case 'S': assert(l == 12, "Bad Analog Monitor!");
+                  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                      m->low = (uint16_t)parse_hex(p + 3, 3);
+                      m->high = (uint16_t)parse_hex(p + 6, 3);
+                      m->hysteresis = (uint16_t)parse_hex(p + 9, 3);
+                      m->state = '?';
+                      m->pending = false;
+                  }
+                  g_adc_monitor_mask |= adc_channel_bit(channel);
+                  adc_scan(ADC_SCAN_MONITOR, g_adc_monitor_mask);
+                  break;
+        case 'X': adc_monitor_disable(channel); break;
+        case 'C': for (uint8_t i = 0 ; i < 16 ; i++) {
+                      if (g_adc_monitor[i].state != 0) {
+                          adc_monitor_disable(i);
+                      }
+                  }
+                  break;
+        case 'R': assert(m->state != 0, "Analog Monitor Not Enabled!");
+                  break;
+        default: assert(0, "Bad Analog Monitor Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    if (p[1] == 'R') {
+        uint16_t value;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            value = g_adc_value[channel];
+        }
+        print_c(m->state);
+        print_hex_digit(value >> 8U);
+        print_hex(value & 0xFFU);
+    }
+    print_end_of_line();
+}
+
+
+
+#endif // ADC_MONITOR_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
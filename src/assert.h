@@ -16,6 +16,7 @@ static void error(const uint16_t code, const char* const message)
                   __attribute__ ((noinline));
 
 
+#ifndef get_pc
 #define get_pc() \
 ({ \
     volatile uint16_t address; \
@@ -27,6 +28,7 @@ static void error(const uint16_t code, const char* const message)
     address <<= 1U; \
     address; \
 })         
+#endif
 
 
 #define assert(test, message) \
@@ -0,0 +1,168 @@
+//==============================================================================
+// AVR ADC Background Scanner.
+//
+// Converts a list of channels round-robin from the ADC Conversion Complete
+// interrupt. The latest value of each scanned channel is kept in
+// `g_adc_value[]` and passed to `adc_sample_ready()` from the ISR.
+//
+// Channels are numbered 0-7 for ADC0-7 (Port F) and 8-15 for ADC8-15
+// (Port K).
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef AVR_ADC_H_INCLUDED
+#define AVR_ADC_H_INCLUDED
+
+
+// Called from the ADC ISR for every conversion. Defined in main.c.
+static void adc_sample_ready(const uint8_t channel, const uint16_t value);
+
+
+static volatile uint16_t g_adc_value[16];
+
+// Scan users, each with their own channel mask.
+enum {
+    ADC_SCAN_MONITOR,
+    ADC_SCAN_TELEMETRY,
+    ADC_SCAN_USERS
+};
+
+static uint16_t g_adc_scan_users[ADC_SCAN_USERS];
+static uint16_t g_adc_scan_mask = 0;            // Channels to scan.
+static uint8_t g_adc_scan_list[16];
+static volatile uint8_t g_adc_scan_n = 0;
+static volatile uint8_t g_adc_scan_i = 0;
+static volatile uint8_t g_adc_channel = 0;      // Channel being converted.
+
+
+static uint16_t adc_channel_bit(const uint8_t channel)
+{
+    return (uint16_t)1U << (channel & 0x0FU);
+}
+
+
+static uint8_t adc_channel(const uint8_t port, const uint8_t pin)
+{
+    switch(port) {
+        case 'F': return pin & 7U;
+        case 'K': return 8U + (pin & 7U);
+        default: assert(0, "Bad ADC Port!");
+    }
+    return 0;
+}
+
+
+// AVCC reference, select channel.
+// [DS40002211A, 26.8.1, Table 26-4]
+static void adc_select(const uint8_t channel)
+{
+    ADMUX = bit1(REFS0) | (channel & 7U);
+    if (channel & 8U) {
+        ADCSRB |= bit1(MUX5);
+    } else {
+        ADCSRB &= (uint8_t)~bit1(MUX5);
+    }
+}
+
+
+// Enable ADC and Conversion Complete interrupt, clear stale ADIF,
+// ADC clock 125 kHz = 16 MHz / 128 (104 us per conversion).
+// [DS40002211A, 26.8.3]
+static void adc_scan_start_conversion(void)
+{
+    g_adc_channel = g_adc_scan_list[g_adc_scan_i];
+    adc_select(g_adc_channel);
+    ADCSRA = bit4(ADEN, ADSC, ADIE, ADIF) | bit3(ADPS2, ADPS1, ADPS0);
+}
+
+
+ISR(ADC_vect)
+{
+    PROFILE_BEGIN();
+    const uint8_t channel = g_adc_channel;
+    const uint16_t value = ADC;
+    g_adc_value[channel] = value;
+
+    if (++g_adc_scan_i >= g_adc_scan_n) {
+        g_adc_scan_i = 0;
+    }
+    if (g_adc_scan_n != 0) {
+        g_adc_channel = g_adc_scan_list[g_adc_scan_i];
+        adc_select(g_adc_channel);
+        ADCSRA |= bit1(ADSC);
+    }
+
+    adc_sample_ready(channel, value);
+    PROFILE_END(PROFILE_ISR_ADC);
+}
+
+
+// Set the channels scanned for `user`.
+static void adc_scan(const uint8_t user, const uint16_t mask)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        g_adc_scan_users[user] = mask;
+        g_adc_scan_mask = 0;
+        for (uint8_t i = 0 ; i < ADC_SCAN_USERS ; i++) {
+            g_adc_scan_mask |= g_adc_scan_users[i];
+        }
+
+        const bool was_running = g_adc_scan_n != 0;
+        uint8_t n = 0;
+        for (uint8_t i = 0 ; i < 16 ; i++) {
+            if (g_adc_scan_mask & adc_channel_bit(i)) {
+                g_adc_scan_list[n++] = i;
+            }
+        }
+        g_adc_scan_n = n;
+        g_adc_scan_i = 0;
+
+        if (n == 0) {
+            ADCSRA &= (uint8_t)~bit1(ADIE);
+        } else if (!was_running) {
+            adc_scan_start_conversion();
+        }
+    }
+}
+
+
+// Read a channel. Scanned channels return the latest background value,
+// otherwise the scan is paused for a single conversion.
+static uint16_t adc_read(const uint8_t port, const uint8_t pin)
+{
+    const uint8_t channel = adc_channel(port, pin);
+    uint16_t value;
+
+    if (g_adc_scan_mask & adc_channel_bit(channel)) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            value = g_adc_value[channel];
+        }
+        return value;
+    }
+
+    if (g_adc_scan_n == 0) {
+        return analog_input(port, pin);
+    }
+
+    ADCSRA &= (uint8_t)~bit1(ADIE);
+    while (ADCSRA & bit1(ADSC)) {}
+    value = analog_input(port, pin);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (g_adc_scan_n != 0) {
+            adc_scan_start_conversion();
+        }
+    }
+    return value;
+}
+
+
+
+#endif // AVR_ADC_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,386 @@
+//==============================================================================
+// AVR Input Capture and External Clock Counting.
+//
+// Frequency, period, duty cycle and edge count measurement.
+//
+//  - Input Capture on ICP1 (PD4), ICP3 (PE7), ICP4 (PL0) and ICP5 (PL1).
+//    The timer runs at clk/1 and is extended to 32 bits by counting
+//    overflows, so periods from 62.5 ns to ~268 s can be measured.
+//    Mode 'P' captures rising edges (period only).
+//    Mode 'W' captures both edges (period and high time).
+//
+//  - External clock counting on T0 (PD7), T1 (PD6) and T5 (PL2).
+//    The hardware counts rising edges with no per-edge interrupt,
+//    frequency is counts / elapsed time between reports.
+//
+// A channel is identified by its timer number. Results are accumulated
+// between reads (or reports) and consumed by each read.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef AVR_CAPTURE_H_INCLUDED
+#define AVR_CAPTURE_H_INCLUDED
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+
+enum {
+    CAPTURE_OFF = 0,
+    CAPTURE_PERIOD = 'P',
+    CAPTURE_WIDTH = 'W',
+    CAPTURE_COUNT = 'T',
+};
+
+
+typedef struct {
+    uint8_t mode;
+    uint16_t interval;              // Report interval in ms (0 = no reports).
+    uint32_t report_time;           // ms_clock32() at last read.
+    uint32_t count_base;            // Counter value at last read.
+    volatile uint32_t overflows;    // Timer high bits.
+    volatile bool primed;           // `last_rise` is valid.
+    volatile uint32_t last_rise;
+    volatile uint32_t edges;        // Rising edges since last read.
+    volatile uint32_t periods;
+    volatile uint32_t period_sum;
+    volatile uint32_t highs;
+    volatile uint32_t high_sum;
+} capture_t;
+
+
+static capture_t g_capture_0;
+static capture_t g_capture_1;
+static capture_t g_capture_3;
+static capture_t g_capture_4;
+static capture_t g_capture_5;
+
+
+static capture_t* capture_channel(const uint8_t timer)
+{
+    switch(timer) {
+        case 0: return &g_capture_0;
+        case 1: return &g_capture_1;
+        case 3: return &g_capture_3;
+        case 4: return &g_capture_4;
+        case 5: return &g_capture_5;
+        default: assert(0, "Bad Capture Channel!");
+    }
+    return 0;
+}
+
+
+
+/* ISRs */
+
+// Accumulate one captured edge.
+static void capture_edge(capture_t* const c, const uint16_t icr,
+                         const bool overflow_pending, const bool rising)
+{
+    // An overflow just before the capture is not counted yet if its
+    // interrupt is still pending.
+    uint16_t high = (uint16_t)c->overflows;
+    if (overflow_pending && icr < 0x8000U) {
+        high++;
+    }
+    const uint32_t t = ((uint32_t)high << 16U) | icr;
+
+    if (rising) {
+        if (c->primed) {
+            c->period_sum += t - c->last_rise;
+            c->periods++;
+        }
+        c->last_rise = t;
+        c->primed = true;
+        c->edges++;
+    } else if (c->primed) {
+        c->high_sum += t - c->last_rise;
+        c->highs++;
+    }
+}
+
+
+// On Input Capture, accumulate edge and (in 'W' mode) flip edge select.
+// ICFn must be cleared after changing ICESn. [DS40002211A, 17.6.3]
+#define CAPTURE_ISR(n) \
+ISR(TIMER##n##_CAPT_vect) \
+{ \
+    PROFILE_BEGIN(); \
+    const uint16_t icr = ICR##n; \
+    const bool rising = TCCR##n##B & bit1(ICES##n); \
+    if (g_capture_##n.mode == CAPTURE_WIDTH) { \
+        TCCR##n##B ^= bit1(ICES##n); \
+        TIFR##n = bit1(ICF##n); \
+    } \
+    capture_edge(&g_capture_##n, icr, TIFR##n & bit1(TOV##n), rising); \
+    PROFILE_END(PROFILE_ISR_CAPTURE); \
+} \
+\
+ISR(TIMER##n##_OVF_vect) \
+{ \
+    g_capture_##n.overflows++; \
+}
+
+CAPTURE_ISR(1)
+CAPTURE_ISR(3)
+CAPTURE_ISR(4)
+#ifndef PROFILE
+CAPTURE_ISR(5)                      // Timer 5 is the profiling clock.
+#endif
+
+ISR(TIMER0_OVF_vect)
+{
+    g_capture_0.overflows++;
+}
+
+
+
+/* Config */
+
+// Normal mode, clk/1, capture rising edge, Input Capture and Overflow
+// interrupts enabled.
+// [DS40002211A, 17.11]
+static void capture_timer_start(const uint8_t timer)
+{
+    switch(timer) {
+        case 1: TCCR1A = 0; TCNT1 = 0; TCCR1B = bit2(ICES1, CS10);
+                TIFR1 = bit2(ICF1, TOV1); TIMSK1 = bit2(ICIE1, TOIE1); break;
+        case 3: TCCR3A = 0; TCNT3 = 0; TCCR3B = bit2(ICES3, CS30);
+                TIFR3 = bit2(ICF3, TOV3); TIMSK3 = bit2(ICIE3, TOIE3); break;
+        case 4: TCCR4A = 0; TCNT4 = 0; TCCR4B = bit2(ICES4, CS40);
+                TIFR4 = bit2(ICF4, TOV4); TIMSK4 = bit2(ICIE4, TOIE4); break;
+        case 5: TCCR5A = 0; TCNT5 = 0; TCCR5B = bit2(ICES5, CS50);
+                TIFR5 = bit2(ICF5, TOV5); TIMSK5 = bit2(ICIE5, TOIE5); break;
+        default: assert(0, "No Input Capture Pin!");
+    }
+}
+
+
+// Normal mode, external clock on Tn rising edge, Overflow interrupt enabled.
+// [DS40002211A, Table 16-9, Table 17-6]
+static void counter_timer_start(const uint8_t timer)
+{
+    switch(timer) {
+        case 0: TCCR0A = 0; TCNT0 = 0; TCCR0B = bit3(CS02, CS01, CS00);
+                TIFR0 = bit1(TOV0); TIMSK0 = bit1(TOIE0); break;
+        case 1: TCCR1A = 0; TCNT1 = 0; TCCR1B = bit3(CS12, CS11, CS10);
+                TIFR1 = bit1(TOV1); TIMSK1 = bit1(TOIE1); break;
+        case 5: TCCR5A = 0; TCNT5 = 0; TCCR5B = bit3(CS52, CS51, CS50);
+                TIFR5 = bit1(TOV5); TIMSK5 = bit1(TOIE5); break;
+        default: assert(0, "No External Clock Pin!");
+    }
+}
+
+
+static void capture_timer_stop(const uint8_t timer)
+{
+    switch(timer) {
+        case 0: TIMSK0 = 0; TCCR0B = 0; break;
+        case 1: TIMSK1 = 0; TCCR1B = 0; break;
+        case 3: TIMSK3 = 0; TCCR3B = 0; break;
+        case 4: TIMSK4 = 0; TCCR4B = 0; break;
+        case 5: TIMSK5 = 0; TCCR5B = 0; break;
+    }
+}
+
+
+// Read the 32-bit extended external clock count.
+static uint32_t counter_read(const uint8_t timer, capture_t* const c)
+{
+    uint32_t n = 0;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint32_t o = c->overflows;
+        switch(timer) {
+            case 0: {
+                const uint8_t t = TCNT0;
+                if ((TIFR0 & bit1(TOV0)) && t < 0x80U) { o++; }
+                n = (o << 8U) | t;
+            } break;
+            case 1: {
+                const uint16_t t = TCNT1;
+                if ((TIFR1 & bit1(TOV1)) && t < 0x8000U) { o++; }
+                n = (o << 16U) | t;
+            } break;
+            case 5: {
+                const uint16_t t = TCNT5;
+                if ((TIFR5 & bit1(TOV5)) && t < 0x8000U) { o++; }
+                n = (o << 16U) | t;
+            } break;
+        }
+    }
+    return n;
+}
+
+
+static void capture_stop(const uint8_t timer)
+{
+    capture_t* const c = capture_channel(timer);
+    if (c->mode == CAPTURE_OFF) {
+        return;
+    }
+    capture_timer_stop(timer);
+    c->mode = CAPTURE_OFF;
+    c->interval = 0;
+    timer_release(timer, 'C');
+}
+
+
+static void capture_start(const uint8_t timer, const uint8_t mode)
+{
+    capture_t* const c = capture_channel(timer);
+    timer_claim(timer, 'C');
+    timer_power_on(timer);
+    capture_timer_stop(timer);
+
+    c->mode = mode;
+    c->interval = 0;
+    c->report_time = ms_clock32();
+    c->count_base = 0;
+    c->overflows = 0;
+    c->primed = false;
+    c->edges = 0;
+    c->periods = 0;
+    c->period_sum = 0;
+    c->highs = 0;
+    c->high_sum = 0;
+
+    if (mode == CAPTURE_COUNT) {
+        counter_timer_start(timer);
+    } else {
+        capture_timer_start(timer);
+    }
+}
+
+
+
+/* Results */
+
+// Print frequency (0.01 Hz units), mean period (clk/1 ticks),
+// duty cycle (1/65536 units) and edge count, then start a new window.
+static void capture_print_result(const uint8_t timer, capture_t* const c)
+{
+    const uint32_t now = ms_clock32();
+    uint32_t frequency = 0;
+    uint32_t period = 0;
+    uint32_t duty = 0;
+    uint32_t edges = 0;
+
+    if (c->mode == CAPTURE_COUNT) {
+        const uint32_t count = counter_read(timer, c);
+        const uint32_t n = count - c->count_base;
+        const uint32_t dt = now - c->report_time;
+        if (dt != 0) {
+            frequency = (uint32_t)((uint64_t)n * 100000U / dt);
+        }
+        if (n != 0) {
+            period = (uint32_t)((uint64_t)dt * (F_CPU / 1000U) / n);
+        }
+        edges = n;
+        c->count_base = count;
+    } else {
+        uint32_t periods, period_sum, highs, high_sum;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            periods = c->periods;       c->periods = 0;
+            period_sum = c->period_sum; c->period_sum = 0;
+            highs = c->highs;           c->highs = 0;
+            high_sum = c->high_sum;     c->high_sum = 0;
+            edges = c->edges;           c->edges = 0;
+        }
+        if (periods != 0 && period_sum != 0) {
+            frequency = (uint32_t)((uint64_t)periods * F_CPU * 100U
+                                   / period_sum);
+            period = period_sum / periods;
+        }
+        if (highs != 0 && periods != 0 && period_sum != 0) {
+            duty = (uint32_t)(((uint64_t)high_sum * periods << 16U)
+                              / ((uint64_t)period_sum * highs));
+            if (duty > 0xFFFFU) {
+                duty = 0xFFFFU;
+            }
+        }
+    }
+    c->report_time = now;
+
+    print_hex32(frequency);
+    print_hex32(period);
+    print_hex16((uint16_t)duty);
+    print_hex32(edges);
+}
+
+
+// Send periodic "!C<timer><result>" reports.
+static void capture_poll_channel(const uint8_t timer, capture_t* const c)
+{
+    if (c->mode == CAPTURE_OFF || c->interval == 0) {
+        return;
+    }
+    if ((uint32_t)(ms_clock32() - c->report_time) >= c->interval) {
+        print_c('!');
+        print_c('C');
+        print_c('0' + timer);
+        capture_print_result(timer, c);
+        print_end_of_line();
+    }
+}
+
+
+static void capture_poll(void)
+{
+    capture_poll_channel(0, &g_capture_0);
+    capture_poll_channel(1, &g_capture_1);
+    capture_poll_channel(3, &g_capture_3);
+    capture_poll_channel(4, &g_capture_4);
+    capture_poll_channel(5, &g_capture_5);
+}
+
+
+
+/* Commands */
+
+// CP<t>        Capture period on ICPt.
+// CW<t>        Capture period and high time on ICPt.
+// CT<t>        Count external clock on Tt.
+// CX<t>        Stop channel t.
+// CR<t>        Read result (and start a new window).
+// CS<t><ms>    Report every <ms> (4 hex digits, 0000 = off).
+static void capture_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 3, "Short Capture Command!");
+    const uint8_t op = p[1];
+    const uint8_t timer = p[2] - (uint8_t)'0';
+    capture_t* const c = capture_channel(timer);
+
+    switch(op) {
+        case 'P':
+        case 'W':
+        case 'T': capture_start(timer, op); break;
+        case 'X': capture_stop(timer); break;
+        case 'R': assert(c->mode != CAPTURE_OFF, "Capture Not Enabled!");
+                  break;
+        case 'S': assert(l == 7, "Bad Capture Interval!");
+                  assert(c->mode != CAPTURE_OFF, "Capture Not Enabled!");
+                  c->interval = (uint16_t)parse_hex(p + 3, 4);
+                  break;
+        default: assert(0, "Bad Capture Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    if (op == 'R') {
+        capture_print_result(timer, c);
+    }
+    print_end_of_line();
+}
+
+
+
+#endif // AVR_CAPTURE_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,289 @@
+//==============================================================================
+// AVR Quadrature Encoder Decoder.
+//
+// Up to ENCODER_COUNT encoders on Port K (PCINT16-23, Arduino A8-A15).
+// Every A/B edge raises the PCINT2 interrupt, the ISR decodes the new
+// (A, B) state against the previous state with a transition table and
+// updates a 32-bit position. An optional index pin zeros the position on
+// its rising edge. Velocity is estimated in the main loop from the
+// position plus the counts removed by index pulses, so an index pulse
+// doesn't show up as a one revolution jump in velocity.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef AVR_ENCODER_H_INCLUDED
+#define AVR_ENCODER_H_INCLUDED
+
+
+#ifndef ENCODER_COUNT
+#define ENCODER_COUNT 2
+#endif
+
+// Velocity estimation window.
+#ifndef ENCODER_VELOCITY_MS
+#define ENCODER_VELOCITY_MS 50U
+#endif
+
+
+typedef struct {
+    uint8_t a_mask;                 // 0 = channel disabled.
+    uint8_t b_mask;
+    uint8_t index_mask;
+    uint8_t state;                  // (A << 1) | B
+    uint8_t index_state;
+    volatile int32_t position;
+    volatile int32_t index_offset;  // Counts removed from position by zeroing.
+    volatile uint16_t errors;       // Transitions with both A and B changed.
+    int32_t velocity;               // Counts per second.
+    uint32_t velocity_position;     // position + index_offset, wrapping.
+    uint32_t velocity_time;
+    uint16_t interval;              // Report interval in ms (0 = no reports).
+    uint32_t report_time;
+} encoder_t;
+
+
+static encoder_t g_encoder[ENCODER_COUNT];
+
+
+// Position change for each (previous state, new state) pair.
+// Gray code sequence 00 -> 01 -> 11 -> 10 -> 00 counts up.
+static const int8_t encoder_table[16] = {
+//  new: 00  01  10  11       previous:
+          0, +1, -1,  0,   // 00
+         -1,  0,  0, +1,   // 01
+         +1,  0,  0, -1,   // 10
+          0, -1, +1,  0,   // 11
+};
+
+
+static uint8_t encoder_state(const encoder_t* const e, const uint8_t pins)
+{
+    return ((pins & e->a_mask) ? 2U : 0U) | ((pins & e->b_mask) ? 1U : 0U);
+}
+
+
+// On Port K Pin Change, decode all enabled encoders.
+ISR(PCINT2_vect)
+{
+    PROFILE_BEGIN();
+    const uint8_t pins = PINK;
+
+    for (uint8_t i = 0 ; i < ENCODER_COUNT ; i++) {
+        encoder_t* const e = &g_encoder[i];
+        if (e->a_mask == 0) {
+            continue;
+        }
+
+        const uint8_t state = encoder_state(e, pins);
+        e->position += encoder_table[(uint8_t)(e->state << 2U) | state];
+        if ((e->state ^ state) == 3U) {
+            e->errors++;
+        }
+        e->state = state;
+
+        const uint8_t index_state = pins & e->index_mask;
+        if (index_state && !e->index_state) {
+            e->index_offset += e->position;
+            e->position = 0;
+        }
+        e->index_state = index_state;
+    }
+    PROFILE_END(PROFILE_ISR_ENCODER);
+}
+
+
+static encoder_t* encoder_channel(const uint8_t c)
+{
+    const uint8_t i = c - (uint8_t)'0';
+    assert(i < ENCODER_COUNT, "Bad Encoder Channel!");
+    return &g_encoder[i];
+}
+
+
+static int32_t encoder_position(const encoder_t* const e)
+{
+    int32_t position;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        position = e->position;
+    }
+    return position;
+}
+
+
+// Position not reset by index pulses or "EZ", for velocity.
+static uint32_t encoder_unwrapped_position(const encoder_t* const e)
+{
+    uint32_t position;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        position = (uint32_t)e->position + (uint32_t)e->index_offset;
+    }
+    return position;
+}
+
+
+static void encoder_zero(encoder_t* const e)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        e->index_offset += e->position;
+        e->position = 0;
+    }
+}
+
+
+// Refresh Pin Change Mask from enabled encoder pins.
+// [DS40002211A, 15.2.7, 15.2.8]
+static void encoder_update_pcint(void)
+{
+    uint8_t mask = 0;
+    for (uint8_t i = 0 ; i < ENCODER_COUNT ; i++) {
+        if (g_encoder[i].a_mask != 0) {
+            mask |= g_encoder[i].a_mask
+                  | g_encoder[i].b_mask
+                  | g_encoder[i].index_mask;
+        }
+    }
+    PCMSK2 = mask;
+    if (mask) {
+        PCICR |= bit1(PCIE2);
+    } else {
+        PCICR &= (uint8_t)~bit1(PCIE2);
+    }
+}
+
+
+static void encoder_enable(encoder_t* const e, const uint8_t a,
+                           const uint8_t b, const uint8_t index)
+{
+    assert(a <= '7' && a >= '0' && b <= '7' && b >= '0', "Bad GPIO Pin!");
+    enable_input_with_pullup('K', a - (uint8_t)'0');
+    enable_input_with_pullup('K', b - (uint8_t)'0');
+    uint8_t index_mask = 0;
+    if (index != '-') {
+        assert(index <= '7' && index >= '0', "Bad GPIO Pin!");
+        enable_input_with_pullup('K', index - (uint8_t)'0');
+        index_mask = bit1(index - (uint8_t)'0');
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        e->a_mask = bit1(a - (uint8_t)'0');
+        e->b_mask = bit1(b - (uint8_t)'0');
+        e->index_mask = index_mask;
+        e->state = encoder_state(e, PINK);
+        e->index_state = PINK & index_mask;
+        e->position = 0;
+        e->index_offset = 0;
+        e->errors = 0;
+        encoder_update_pcint();
+    }
+    e->velocity = 0;
+    e->velocity_position = 0;
+    e->velocity_time = ms_clock32();
+    e->interval = 0;
+}
+
+
+static void encoder_disable(encoder_t* const e)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        e->a_mask = 0;
+        encoder_update_pcint();
+    }
+    e->interval = 0;
+}
+
+
+static void encoder_print(const encoder_t* const e)
+{
+    print_hex32((uint32_t)encoder_position(e));
+    print_hex32((uint32_t)e->velocity);
+}
+
+
+// Update velocity estimates and send "!E<channel><position><velocity>"
+// reports.
+static void encoder_poll(void)
+{
+    const uint32_t now = ms_clock32();
+
+    for (uint8_t i = 0 ; i < ENCODER_COUNT ; i++) {
+        encoder_t* const e = &g_encoder[i];
+        if (e->a_mask == 0) {
+            continue;
+        }
+
+        const uint32_t dt = now - e->velocity_time;
+        if (dt >= ENCODER_VELOCITY_MS) {
+            const uint32_t position = encoder_unwrapped_position(e);
+            e->velocity = (int32_t)(position - e->velocity_position) * 1000L
+                        / (int32_t)dt;
+            e->velocity_position = position;
+            e->velocity_time = now;
+        }
+
+        if (e->interval != 0 && (uint32_t)(now - e->report_time)
+                                >= e->interval) {
+            e->report_time = now;
+            print_c('!');
+            print_c('E');
+            print_c('0' + i);
+            encoder_print(e);
+            print_end_of_line();
+        }
+    }
+}
+
+
+
+/* Commands */
+
+// EE<ch><A><B><index>  Enable encoder on Port K pins A, B (pull-ups on).
+//                      Index pin '-' for none.
+// EX<ch>               Disable.
+// ER<ch>               Read position, velocity (counts/s) and the count
+//                      of transitions with both A and B changed.
+// EZ<ch>               Zero position.
+// ES<ch><ms:4>         Report every <ms> (0000 = off).
+static void encoder_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 3, "Short Encoder Command!");
+    encoder_t* const e = encoder_channel(p[2]);
+
+    switch(p[1]) {
+        case 'E': assert(l == 6, "Bad Encoder Pins!");
+                  encoder_enable(e, p[3], p[4], p[5]);
+                  break;
+        case 'X': encoder_disable(e); break;
+        case 'R': assert(e->a_mask != 0, "Encoder Not Enabled!"); break;
+        case 'Z': encoder_zero(e); break;
+        case 'S': assert(l == 7, "Bad Encoder Interval!");
+                  assert(e->a_mask != 0, "Encoder Not Enabled!");
+                  e->interval = (uint16_t)parse_hex(p + 3, 4);
+                  e->report_time = ms_clock32();
+                  break;
+        default: assert(0, "Bad Encoder Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    if (p[1] == 'R') {
+        encoder_print(e);
+        uint16_t errors;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            errors = e->errors;
+        }
+        print_hex16(errors);
+    }
+    print_end_of_line();
+}
+
+
+
+#endif // AVR_ENCODER_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
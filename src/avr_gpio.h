@@ -1,6 +1,10 @@
 //==============================================================================
 // AVR GPIO
-// 
+//
+// The PORTx/DDRx updates are read-modify-writes (ports H-L and a variable
+// mask can't use SBI/CBI), and the sequencer, reflex and stepper ISRs
+// write the same registers, so they are done with interrupts disabled.
+//
 // Copyright OC Technology Pty Ltd 2021.
 //==============================================================================
 
@@ -33,21 +37,23 @@ uint8_t read_input(const uint8_t port, const uint8_t pin)
 void enable_input_with_pullup(const uint8_t port, const uint8_t pin)
 {
     const uint8_t mask = 1U << (pin & 0x0FU);
-    switch(port) {
-        case 'A': DDRA &= ~mask; PORTA |= mask ; break;
-        case 'B': DDRB &= ~mask; PORTB |= mask ; break;
-        case 'C': DDRC &= ~mask; PORTC |= mask ; break;
-        case 'D': DDRD &= ~mask; PORTD |= mask ; break;
-        #ifdef PINE
-        case 'E': DDRE &= ~mask; PORTE |= mask ; break;
-        case 'F': DDRF &= ~mask; PORTF |= mask ; break;
-        case 'G': DDRG &= ~mask; PORTG |= mask ; break;
-        case 'H': DDRH &= ~mask; PORTH |= mask ; break;
-        case 'J': DDRJ &= ~mask; PORTJ |= mask ; break;
-        case 'K': DDRK &= ~mask; PORTK |= mask ; break;
-        case 'L': DDRL &= ~mask; PORTL |= mask ; break;
-        #endif
-        default: assert(0, "Bad GPIO Port!");
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        switch(port) {
+            case 'A': DDRA &= ~mask; PORTA |= mask ; break;
+            case 'B': DDRB &= ~mask; PORTB |= mask ; break;
+            case 'C': DDRC &= ~mask; PORTC |= mask ; break;
+            case 'D': DDRD &= ~mask; PORTD |= mask ; break;
+            #ifdef PINE
+            case 'E': DDRE &= ~mask; PORTE |= mask ; break;
+            case 'F': DDRF &= ~mask; PORTF |= mask ; break;
+            case 'G': DDRG &= ~mask; PORTG |= mask ; break;
+            case 'H': DDRH &= ~mask; PORTH |= mask ; break;
+            case 'J': DDRJ &= ~mask; PORTJ |= mask ; break;
+            case 'K': DDRK &= ~mask; PORTK |= mask ; break;
+            case 'L': DDRL &= ~mask; PORTL |= mask ; break;
+            #endif
+            default: assert(0, "Bad GPIO Port!");
+        }
     }
 }
 
@@ -55,63 +61,132 @@ void enable_input_with_pullup(const uint8_t port, const uint8_t pin)
 void enable_input_without_pullup(const uint8_t port, const uint8_t pin)
 {
     const uint8_t mask = 1U << (pin & 0x0FU);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        switch(port) {
+            case 'A': DDRA &= ~mask; PORTA &= ~mask ; break;
+            case 'B': DDRB &= ~mask; PORTB &= ~mask ; break;
+            case 'C': DDRC &= ~mask; PORTC &= ~mask ; break;
+            case 'D': DDRD &= ~mask; PORTD &= ~mask ; break;
+            #ifdef PINE
+            case 'E': DDRE &= ~mask; PORTE &= ~mask ; break;
+            case 'F': DDRF &= ~mask; PORTF &= ~mask ; break;
+            case 'G': DDRG &= ~mask; PORTG &= ~mask ; break;
+            case 'H': DDRH &= ~mask; PORTH &= ~mask ; break;
+            case 'J': DDRJ &= ~mask; PORTJ &= ~mask ; break;
+            case 'K': DDRK &= ~mask; PORTK &= ~mask ; break;
+            case 'L': DDRL &= ~mask; PORTL &= ~mask ; break;
+            #endif
+            default: assert(0, "Bad GPIO Port!");
+        }
+    }
+}
+
+
+void output_high(const uint8_t port, const uint8_t pin)
+{
+    const uint8_t mask = 1U << (pin & 0x0FU);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        switch(port) {
+            case 'A': DDRA |= mask; PORTA |= mask ; break;
+            case 'B': DDRB |= mask; PORTB |= mask ; break;
+            case 'C': DDRC |= mask; PORTC |= mask ; break;
+            case 'D': DDRD |= mask; PORTD |= mask ; break;
+            #ifdef PINE
+            case 'E': DDRE |= mask; PORTE |= mask ; break;
+            case 'F': DDRF |= mask; PORTF |= mask ; break;
+            case 'G': DDRG |= mask; PORTG |= mask ; break;
+            case 'H': DDRH |= mask; PORTH |= mask ; break;
+            case 'J': DDRJ |= mask; PORTJ |= mask ; break;
+            case 'K': DDRK |= mask; PORTK |= mask ; break;
+            case 'L': DDRL |= mask; PORTL |= mask ; break;
+            #endif
+            default: assert(0, "Bad GPIO Port!");
+        }
+    }
+}
+
+
+void output_low(const uint8_t port, const uint8_t pin)
+{
+    const uint8_t mask = 1U << (pin & 0x0FU);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        switch(port) {
+            case 'A': DDRA |= mask; PORTA &= ~mask ; break;
+            case 'B': DDRB |= mask; PORTB &= ~mask ; break;
+            case 'C': DDRC |= mask; PORTC &= ~mask ; break;
+            case 'D': DDRD |= mask; PORTD &= ~mask ; break;
+            #ifdef PINE
+            case 'E': DDRE |= mask; PORTE &= ~mask ; break;
+            case 'F': DDRF |= mask; PORTF &= ~mask ; break;
+            case 'G': DDRG |= mask; PORTG &= ~mask ; break;
+            case 'H': DDRH |= mask; PORTH &= ~mask ; break;
+            case 'J': DDRJ |= mask; PORTJ &= ~mask ; break;
+            case 'K': DDRK |= mask; PORTK &= ~mask ; break;
+            case 'L': DDRL |= mask; PORTL &= ~mask ; break;
+            #endif
+            default: assert(0, "Bad GPIO Port!");
+        }
+    }
+}
+
+
+volatile uint8_t* gpio_pin_register(const uint8_t port)
+{
     switch(port) {
-        case 'A': DDRA &= ~mask; PORTA &= ~mask ; break;
-        case 'B': DDRB &= ~mask; PORTB &= ~mask ; break;
-        case 'C': DDRC &= ~mask; PORTC &= ~mask ; break;
-        case 'D': DDRD &= ~mask; PORTD &= ~mask ; break;
+        case 'A': return &PINA;
+        case 'B': return &PINB;
+        case 'C': return &PINC;
+        case 'D': return &PIND;
         #ifdef PINE
-        case 'E': DDRE &= ~mask; PORTE &= ~mask ; break;
-        case 'F': DDRF &= ~mask; PORTF &= ~mask ; break;
-        case 'G': DDRG &= ~mask; PORTG &= ~mask ; break;
-        case 'H': DDRH &= ~mask; PORTH &= ~mask ; break;
-        case 'J': DDRJ &= ~mask; PORTJ &= ~mask ; break;
-        case 'K': DDRK &= ~mask; PORTK &= ~mask ; break;
-        case 'L': DDRL &= ~mask; PORTL &= ~mask ; break;
+        case 'E': return &PINE;
+        case 'F': return &PINF;
+        case 'G': return &PING;
+        case 'H': return &PINH;
+        case 'J': return &PINJ;
+        case 'K': return &PINK;
+        case 'L': return &PINL;
         #endif
         default: assert(0, "Bad GPIO Port!");
     }
 }
 
 
-void output_high(const uint8_t port, const uint8_t pin)
+volatile uint8_t* gpio_port_register(const uint8_t port)
 {
-    const uint8_t mask = 1U << (pin & 0x0FU);
     switch(port) {
-        case 'A': DDRA |= mask; PORTA |= mask ; break;
-        case 'B': DDRB |= mask; PORTB |= mask ; break;
-        case 'C': DDRC |= mask; PORTC |= mask ; break;
-        case 'D': DDRD |= mask; PORTD |= mask ; break;
+        case 'A': return &PORTA;
+        case 'B': return &PORTB;
+        case 'C': return &PORTC;
+        case 'D': return &PORTD;
         #ifdef PINE
-        case 'E': DDRE |= mask; PORTE |= mask ; break;
-        case 'F': DDRF |= mask; PORTF |= mask ; break;
-        case 'G': DDRG |= mask; PORTG |= mask ; break;
-        case 'H': DDRH |= mask; PORTH |= mask ; break;
-        case 'J': DDRJ |= mask; PORTJ |= mask ; break;
-        case 'K': DDRK |= mask; PORTK |= mask ; break;
-        case 'L': DDRL |= mask; PORTL |= mask ; break;
+        case 'E': return &PORTE;
+        case 'F': return &PORTF;
+        case 'G': return &PORTG;
+        case 'H': return &PORTH;
+        case 'J': return &PORTJ;
+        case 'K': return &PORTK;
+        case 'L': return &PORTL;
         #endif
         default: assert(0, "Bad GPIO Port!");
     }
 }
 
 
-void output_low(const uint8_t port, const uint8_t pin)
+volatile uint8_t* gpio_ddr_register(const uint8_t port)
 {
-    const uint8_t mask = 1U << (pin & 0x0FU);
     switch(port) {
-        case 'A': DDRA |= mask; PORTA &= ~mask ; break;
-        case 'B': DDRB |= mask; PORTB &= ~mask ; break;
-        case 'C': DDRC |= mask; PORTC &= ~mask ; break;
-        case 'D': DDRD |= mask; PORTD &= ~mask ; break;
+        case 'A': return &DDRA;
+        case 'B': return &DDRB;
+        case 'C': return &DDRC;
+        case 'D': return &DDRD;
         #ifdef PINE
-        case 'E': DDRE |= mask; PORTE &= ~mask ; break;
-        case 'F': DDRF |= mask; PORTF &= ~mask ; break;
-        case 'G': DDRG |= mask; PORTG &= ~mask ; break;
-        case 'H': DDRH |= mask; PORTH &= ~mask ; break;
-        case 'J': DDRJ |= mask; PORTJ &= ~mask ; break;
-        case 'K': DDRK |= mask; PORTK &= ~mask ; break;
-        case 'L': DDRL |= mask; PORTL &= ~mask ; break;
+        case 'E': return &DDRE;
+        case 'F': return &DDRF;
+        case 'G': return &DDRG;
+        case 'H': return &DDRH;
+        case 'J': return &DDRJ;
+        case 'K': return &DDRK;
+        case 'L': return &DDRL;
         #endif
         default: assert(0, "Bad GPIO Port!");
     }
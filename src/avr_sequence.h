@@ -0,0 +1,250 @@
+//==============================================================================
+// AVR Timed Output Sequencer.
+//
+// Plays back a list of (delay, port, mask, value) steps from SRAM.
+// Timer/Counter 3 runs in CTC mode at 2 MHz (0.5 us resolution). Each
+// compare match applies the due step(s) and loads the next delay, so step
+// timing does not depend on the main loop or the host link.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef AVR_SEQUENCE_H_INCLUDED
+#define AVR_SEQUENCE_H_INCLUDED
+
+
+#ifndef SEQUENCE_SIZE
+#define SEQUENCE_SIZE 64
+#endif
+
+// Shortest non-zero step delay (must exceed worst case ISR latency).
+#define SEQUENCE_MIN_TICKS 20U
+
+
+typedef struct {
+    uint32_t delay;                 // Timer ticks (0.5 us) before this step.
+    volatile uint8_t* port;
+    uint8_t mask;
+    uint8_t value;
+} sequence_step_t;
+
+
+static sequence_step_t g_sequence[SEQUENCE_SIZE];
+static uint8_t g_sequence_length = 0;
+static volatile uint8_t g_sequence_i = 0;       // Next step.
+static volatile uint32_t g_sequence_wait = 0;   // Ticks left after this match.
+static volatile uint16_t g_sequence_loops = 0;  // Plays left (0 = forever).
+static volatile bool g_sequence_running = false;
+static volatile bool g_sequence_done = false;
+
+
+
+/* Timer */
+
+// CTC mode, TOP = OCR3A, clk/8.
+// [DS40002211A, Table 17-2, Table 17-6]
+static void sequence_timer_start(void)
+{
+    TCCR3A = 0;
+    TCNT3 = 0;
+    TIFR3 = bit1(OCF3A);
+    TIMSK3 = bit1(OCIE3A);
+    TCCR3B = bit2(WGM32, CS31);
+}
+
+
+static void sequence_timer_stop(void)
+{
+    TIMSK3 = 0;
+    TCCR3B = 0;
+}
+
+
+// Load the next compare interval, splitting delays longer than 16 bits.
+// OCR3A is written just after TCNT3 wraps to 0, so the interval is exact
+// as long as it is longer than the ISR latency.
+static void sequence_schedule(const uint32_t ticks)
+{
+    uint32_t chunk = ticks;
+    if (ticks > 0x10000UL) {
+        chunk = (ticks - 0x10000UL < SEQUENCE_MIN_TICKS) ? 0x8000UL
+                                                         : 0x10000UL;
+    }
+    g_sequence_wait = ticks - chunk;
+    OCR3A = (uint16_t)(chunk - 1U);
+}
+
+
+// Apply due steps, then schedule the next one.
+static void sequence_run(void)
+{
+    for (;;) {
+        const sequence_step_t* const s = &g_sequence[g_sequence_i];
+        *s->port = (*s->port & (uint8_t)~s->mask) | (s->value & s->mask);
+
+        if (++g_sequence_i == g_sequence_length) {
+            g_sequence_i = 0;
+            if (g_sequence_loops == 1) {
+                sequence_timer_stop();
+                g_sequence_running = false;
+                g_sequence_done = true;
+                return;
+            }
+            if (g_sequence_loops != 0) {
+                g_sequence_loops--;
+            }
+        }
+
+        const uint32_t delay = g_sequence[g_sequence_i].delay;
+        if (delay != 0) {
+            sequence_schedule(delay);
+            return;
+        }
+    }
+}
+
+
+ISR(TIMER3_COMPA_vect)
+{
+    PROFILE_BEGIN();
+    if (g_sequence_wait != 0) {
+        sequence_schedule(g_sequence_wait);
+    } else {
+        sequence_run();
+    }
+    PROFILE_END(PROFILE_ISR_SEQUENCE);
+}
+
+
+
+/* Control */
+
+static void sequence_stop(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (g_sequence_running) {
+            sequence_timer_stop();
+            g_sequence_running = false;
+        }
+    }
+    timer_release(3, 'S');
+}
+
+
+static void sequence_start(const uint16_t loops)
+{
+    assert(g_sequence_length > 0, "Empty Sequence!");
+    assert(!g_sequence_running, "Sequence Running!");
+
+    uint32_t total = 0;
+    for (uint8_t i = 0 ; i < g_sequence_length ; i++) {
+        total += g_sequence[i].delay;
+    }
+    assert(loops == 1 || total != 0, "Zero Length Sequence Loop!");
+
+    timer_claim(3, 'S');
+    timer_power_on(3);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        g_sequence_i = 0;
+        g_sequence_loops = loops;
+        g_sequence_done = false;
+        g_sequence_running = true;
+        sequence_timer_start();
+        if (g_sequence[0].delay == 0) {
+            OCR3A = 0xFFFFU;
+            sequence_run();
+        } else {
+            sequence_schedule(g_sequence[0].delay);
+        }
+    }
+}
+
+
+static void sequence_append(const uint32_t us, const uint8_t port,
+                            const uint8_t mask, const uint8_t value)
+{
+    assert(!g_sequence_running, "Sequence Running!");
+    assert(g_sequence_length < SEQUENCE_SIZE, "Sequence Full!");
+    assert(us < 0x80000000UL, "Sequence Delay Too Long!");
+
+    const uint32_t ticks = us * 2U;
+    assert(ticks == 0 || ticks >= SEQUENCE_MIN_TICKS,
+           "Sequence Delay Too Short!");
+
+    sequence_step_t* const s = &g_sequence[g_sequence_length++];
+    s->delay = ticks;
+    s->port = gpio_port_register(port);
+    s->mask = mask;
+    s->value = value;
+
+    // Sequenced pins are outputs.
+    *gpio_ddr_register(port) |= mask;
+}
+
+
+// Send "!SD" when a sequence finishes.
+static void sequence_poll(void)
+{
+    if (g_sequence_done) {
+        g_sequence_done = false;
+        timer_release(3, 'S');
+        print_c('!');
+        print_c('S');
+        print_c('D');
+        print_end_of_line();
+    }
+}
+
+
+
+/* Commands */
+
+// SC                                       Stop and clear sequence.
+// SA<us:8><port><mask:2><value:2>          Append step (pins become outputs).
+// SG                                       Play once.
+// SL<loops:4>                              Play <loops> times (0 = forever).
+// SX                                       Stop.
+// SQ                                       Query running, next step, length.
+static void sequence_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 2, "Short Sequence Command!");
+
+    switch(p[1]) {
+        case 'C': sequence_stop();
+                  g_sequence_length = 0;
+                  break;
+        case 'A': assert(l == 15, "Bad Sequence Step!");
+                  sequence_append(parse_hex(p + 2, 8), p[10],
+                                  (uint8_t)parse_hex(p + 11, 2),
+                                  (uint8_t)parse_hex(p + 13, 2));
+                  break;
+        case 'G': sequence_start(1); break;
+        case 'L': assert(l == 6, "Bad Sequence Loops!");
+                  sequence_start((uint16_t)parse_hex(p + 2, 4));
+                  break;
+        case 'X': sequence_stop(); break;
+        case 'Q': break;
+        default: assert(0, "Bad Sequence Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    if (p[1] == 'Q') {
+        print_hex(g_sequence_running);
+        print_hex(g_sequence_i);
+        print_hex(g_sequence_length);
+    }
+    print_end_of_line();
+}
+
+
+
+#endif // AVR_SEQUENCE_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
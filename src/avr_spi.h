@@ -0,0 +1,239 @@
+//==============================================================================
+// AVR SPI Master.
+//
+// Hardware SPI on Port B (SS = PB0, SCK = PB1, MOSI = PB2, MISO = PB3,
+// Arduino pins 53, 52, 51, 50) with any GPIO pin as chip select.
+// A transfer clocks out up to SPI_BUFFER_SIZE bytes and keeps the bytes
+// read from MISO.
+//
+// At fast clocks (up to clk/8, 64 CPU cycles per byte) a byte completes
+// sooner than an interrupt could be serviced, so the transfer is polled.
+// At slower clocks the SPI STC interrupt loads each next byte and the main
+// loop keeps running. Commands wait until the transfer has finished.
+//
+// PB0 is always an output while SPI is enabled, otherwise a low level on
+// SS would switch the SPI to slave mode. [DS40002211A, 21.3.2]
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef AVR_SPI_H_INCLUDED
+#define AVR_SPI_H_INCLUDED
+
+
+#ifndef SPI_BUFFER_SIZE
+#define SPI_BUFFER_SIZE 64
+#endif
+
+// Slowest clock divider that is polled.
+#define SPI_POLL_MAX_DIVIDER 8U
+
+// Called from the ISR when an interrupt driven transfer finishes.
+#ifndef SPI_DONE_NOTIFY
+#define SPI_DONE_NOTIFY()
+#endif
+
+
+static uint8_t g_spi_tx[SPI_BUFFER_SIZE];
+static uint8_t g_spi_rx[SPI_BUFFER_SIZE];
+static uint8_t g_spi_length = 0;
+static volatile uint8_t g_spi_i = 0;            // Byte being transferred.
+static volatile bool g_spi_busy = false;
+static bool g_spi_response = false;             // Response not yet sent.
+static bool g_spi_release = false;              // Deselect after transfer.
+static uint8_t g_spi_command = 0;               // 'T' or 'K'.
+static uint8_t g_spi_divider = 0;               // 0 = SPI disabled.
+static volatile uint8_t* g_spi_cs_port = NULL;
+static uint8_t g_spi_cs_mask = 0;
+
+
+static void spi_deselect(void)
+{
+    *g_spi_cs_port |= g_spi_cs_mask;
+}
+
+
+// Store the byte received, send the next one.
+ISR(SPI_STC_vect)
+{
+    PROFILE_BEGIN();
+    g_spi_rx[g_spi_i] = SPDR;
+    if (++g_spi_i < g_spi_length) {
+        SPDR = g_spi_tx[g_spi_i];
+    } else {
+        SPCR &= (uint8_t)~bit1(SPIE);
+        if (g_spi_release) {
+            spi_deselect();
+        }
+        g_spi_busy = false;
+        SPI_DONE_NOTIFY();
+    }
+    PROFILE_END(PROFILE_ISR_SPI);
+}
+
+
+
+/* Control */
+
+// Master mode, SPI mode 0-3 (CPOL, CPHA), clock clk/2^(clock + 1).
+// [DS40002211A, 21.5.1, Table 21-3, Table 21-4, Table 21-5]
+static void spi_enable(const uint8_t mode, const uint8_t clock,
+                       const bool lsb_first,
+                       const uint8_t cs_port, const uint8_t cs_pin)
+{
+    assert(mode <= 3, "Bad SPI Mode!");
+    assert(clock <= 6, "Bad SPI Clock!");
+    assert(!g_spi_busy, "SPI Busy!");
+
+    // Chip select idles high.
+    if (g_spi_divider != 0) {
+        spi_deselect();
+    }
+    output_high(cs_port, cs_pin);
+    g_spi_cs_port = gpio_port_register(cs_port);
+    g_spi_cs_mask = bit1(cs_pin);
+
+    // SS, SCK and MOSI are outputs, MISO is an input.
+    // [DS40002211A, Table 21-1]
+    DDRB |= bit3(0, 1, 2);
+    DDRB &= (uint8_t)~bit1(3);
+
+    // clk/2, /4, /8 ... /64 alternate SPI2X = 1, 0. clk/128 is SPR = 3.
+    PRR0 &= (uint8_t)~bit1(PRSPI);
+    SPCR = bit2(SPE, MSTR)
+         | (lsb_first ? bit1(DORD) : 0U)
+         | (uint8_t)(mode << CPHA)
+         | (uint8_t)(clock / 2U);
+    SPSR = (clock < 6 && (clock & 1U) == 0) ? bit1(SPI2X) : 0U;
+    g_spi_divider = (uint8_t)(2U << clock);
+}
+
+
+static void spi_disable(void)
+{
+    assert(!g_spi_busy, "SPI Busy!");
+    if (g_spi_divider != 0) {
+        spi_deselect();
+    }
+    SPCR = 0;
+    g_spi_divider = 0;
+}
+
+
+// Select the device and start sending `g_spi_tx`.
+static void spi_start(const uint8_t n, const bool release)
+{
+    assert(g_spi_divider != 0, "SPI Not Enabled!");
+    assert(n >= 1 && n <= SPI_BUFFER_SIZE, "Bad SPI Transfer Length!");
+
+    g_spi_length = n;
+    g_spi_release = release;
+    g_spi_i = 0;
+    *g_spi_cs_port &= (uint8_t)~g_spi_cs_mask;
+
+    if (g_spi_divider <= SPI_POLL_MAX_DIVIDER) {
+        for (uint8_t i = 0 ; i < n ; i++) {
+            SPDR = g_spi_tx[i];
+            while (!(SPSR & bit1(SPIF))) {}
+            g_spi_rx[i] = SPDR;
+        }
+        if (release) {
+            spi_deselect();
+        }
+        return;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        g_spi_busy = true;
+        SPCR |= bit1(SPIE);
+        SPDR = g_spi_tx[0];
+    }
+}
+
+
+static void spi_print_response(void)
+{
+    print_c('>');
+    print_c('X');
+    print_c(g_spi_command);
+    for (uint8_t i = 0 ; i < g_spi_length ; i++) {
+        print_hex(g_spi_tx[i]);
+    }
+    for (uint8_t i = 0 ; i < g_spi_length ; i++) {
+        print_hex(g_spi_rx[i]);
+    }
+    print_end_of_line();
+}
+
+
+// Send the response of a finished transfer.
+// Returns false while a transfer is running.
+static bool spi_poll(void)
+{
+    if (g_spi_busy) {
+        return false;
+    }
+    if (g_spi_response) {
+        g_spi_response = false;
+        spi_print_response();
+    }
+    return true;
+}
+
+
+
+/* Commands */
+
+// XC<mode:1><clock:1><order><port><pin>    Enable, SPI mode 0-3,
+//                                          clk/2^(clock + 1) (0-6),
+//                                          M = MSB first, L = LSB first,
+//                                          chip select pin (e.g. B0).
+// XT<bytes:2n>     Transfer 1 to SPI_BUFFER_SIZE bytes, then deselect.
+// XK<bytes:2n>     Transfer, keep selected (continued by the next XT/XK).
+// XX               Disable.
+//
+// XT and XK respond with the bytes sent followed by the bytes received.
+static void spi_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 2, "Short SPI Command!");
+
+    switch(p[1]) {
+        case 'C': assert(l == 7, "Bad SPI Config!");
+                  assert(p[4] == 'M' || p[4] == 'L', "Bad SPI Bit Order!");
+                  assert(p[6] >= '0' && p[6] <= '7', "Bad GPIO Pin!");
+                  spi_enable(parse_hex_digit(p[2]), parse_hex_digit(p[3]),
+                             p[4] == 'L', p[5], p[6] - (uint8_t)'0');
+                  break;
+        case 'T':
+        case 'K': assert(l >= 4 && (l & 1U) == 0, "Bad SPI Transfer!");
+                  {
+                      const uint8_t n = (uint8_t)((l - 2U) / 2U);
+                      assert(n <= SPI_BUFFER_SIZE, "SPI Transfer Too Long!");
+                      for (uint8_t i = 0 ; i < n ; i++) {
+                          g_spi_tx[i] = (uint8_t)parse_hex(p + 2 + 2 * i, 2);
+                      }
+                      g_spi_command = p[1];
+                      g_spi_response = true;
+                      spi_start(n, p[1] == 'T');
+                  }
+                  spi_poll();
+                  return;
+        case 'X': spi_disable(); break;
+        default: assert(0, "Bad SPI Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    print_end_of_line();
+}
+
+
+
+#endif // AVR_SPI_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -8,13 +8,21 @@
 //==============================================================================
 
 
-static volatile uint8_t g_timer2_clock = 0U;
-static uint8_t timer2_clock(void) { return g_timer2_clock; }
+// Called from the 1 kHz ISR.
+#ifndef TIMER2_TICK_NOTIFY
+#define TIMER2_TICK_NOTIFY()
+#endif
+
+static volatile uint32_t g_timer2_clock = 0U;
+static uint8_t timer2_clock(void) { return (uint8_t)g_timer2_clock; }
 static void timer2_clock_increment(void) { g_timer2_clock++; }
 
 ISR(TIMER2_COMPA_vect)
 {
+    PROFILE_BEGIN();
     timer2_clock_increment();
+    TIMER2_TICK_NOTIFY();
+    PROFILE_END(PROFILE_ISR_TIMER2);
 }
 
 // Clear Timer on Compare mode.
@@ -49,6 +57,32 @@ static uint8_t ms_clock(void)
 }
 
 
+// Microsecond timestamp (4 us resolution, wraps after 65 ms) for timing
+// gaps between events. Call with interrupts disabled. A compare match
+// not yet counted by the ISR shows as OCF2A set with TCNT2 restarted.
+// [DS40002061B, 18.11.7, p167]
+static uint16_t timer2_us_clock16(void)
+{
+    uint16_t ms = (uint16_t)g_timer2_clock;
+    const uint8_t t = TCNT2;
+    if ((TIFR2 & bit1(OCF2A)) && t < 125U) {
+        ms++;
+    }
+    return (uint16_t)(ms * 1000U + t * 4U);
+}
+
+
+// 32-bit millisecond timestamp (wraps after ~49 days).
+static uint32_t ms_clock32(void)
+{
+    uint32_t t;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t = g_timer2_clock;
+    }
+    return t;
+}
+
+
 
 //==============================================================================
 // End of file.
@@ -0,0 +1,56 @@
+//==============================================================================
+// AVR Timer/Counter Allocation.
+//
+// Timer/Counters 0, 1, 3, 4 and 5 are shared between several features.
+// Each feature claims a timer before reconfiguring it and releases it when
+// done. Timer/Counter 2 is reserved for the millisecond clock.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef AVR_TIMERS_H_INCLUDED
+#define AVR_TIMERS_H_INCLUDED
+
+
+// Owner of each Timer/Counter, indexed by timer number (0 = free).
+static uint8_t g_timer_owner[6] = {0, 0, 'T', 0, 0, 0};
+
+
+static void timer_claim(const uint8_t timer, const uint8_t owner)
+{
+    assert(timer < sizeof(g_timer_owner), "Bad Timer!");
+    assert(g_timer_owner[timer] == 0 || g_timer_owner[timer] == owner,
+           "Timer Busy!");
+    g_timer_owner[timer] = owner;
+}
+
+
+static void timer_release(const uint8_t timer, const uint8_t owner)
+{
+    if (timer < sizeof(g_timer_owner) && g_timer_owner[timer] == owner) {
+        g_timer_owner[timer] = 0;
+    }
+}
+
+
+// Wake Timer/Counter via Power Reduction Registers.
+// [DS40002211A, 11.10.2, 11.10.3]
+static void timer_power_on(const uint8_t timer)
+{
+    switch(timer) {
+        case 0: PRR0 &= (uint8_t)~bit1(PRTIM0); break;
+        case 1: PRR0 &= (uint8_t)~bit1(PRTIM1); break;
+        case 3: PRR1 &= (uint8_t)~bit1(PRTIM3); break;
+        case 4: PRR1 &= (uint8_t)~bit1(PRTIM4); break;
+        case 5: PRR1 &= (uint8_t)~bit1(PRTIM5); break;
+        default: assert(0, "Bad Timer!");
+    }
+}
+
+
+
+#endif // AVR_TIMERS_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
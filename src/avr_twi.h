@@ -0,0 +1,354 @@
+//==============================================================================
+// AVR TWI (I2C) Master.
+//
+// Interrupt driven TWI master on SCL = PD0, SDA = PD1 (Arduino pins 21,
+// 20). A transaction writes 0 to TWI_BUFFER_SIZE bytes (e.g. a register
+// address and data), then, after a repeated START, reads 0 to
+// TWI_BUFFER_SIZE bytes. Each TWINT interrupt advances the transaction by
+// one bus operation, so the main loop keeps running. Commands wait until
+// the transaction has finished.
+//
+// A bus scan addresses each of 0x08-0x77 for writing and records which
+// devices ACK. Consecutive addresses are separated by STOP, START.
+//
+// The internal pull-ups are enabled on SCL and SDA, external pull-ups
+// are still needed above 100 kHz.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef AVR_TWI_H_INCLUDED
+#define AVR_TWI_H_INCLUDED
+
+
+#ifndef TWI_BUFFER_SIZE
+#define TWI_BUFFER_SIZE 32
+#endif
+
+// Abort a transaction (e.g. SCL held low) after this long.
+#define TWI_TIMEOUT_MS 250U
+
+#define TWI_SCAN_FIRST 0x08U
+#define TWI_SCAN_LAST 0x77U
+
+// Called when a transaction finishes (interrupts disabled).
+#ifndef TWI_DONE_NOTIFY
+#define TWI_DONE_NOTIFY()
+#endif
+
+
+// Transaction result.
+enum {
+    TWI_OK,
+    TWI_ADDRESS_NACK,
+    TWI_DATA_NACK,
+    TWI_ARBITRATION_LOST,
+    TWI_BUS_ERROR,
+    TWI_TIMEOUT
+};
+
+
+static uint8_t g_twi_tx[TWI_BUFFER_SIZE];
+static uint8_t g_twi_rx[TWI_BUFFER_SIZE];
+static uint8_t g_twi_found[16];                 // Scan result, bit per address.
+static uint8_t g_twi_address = 0;
+static uint8_t g_twi_tx_n = 0;
+static uint8_t g_twi_rx_n = 0;
+static volatile uint8_t g_twi_i = 0;            // Bytes sent or received.
+static volatile uint8_t g_twi_status = TWI_OK;
+static volatile bool g_twi_busy = false;
+static bool g_twi_scan = false;
+static bool g_twi_response = false;             // Response not yet sent.
+static bool g_twi_enabled = false;
+static uint32_t g_twi_start_time = 0;
+
+
+#define TWI_GO bit3(TWINT, TWEN, TWIE)
+
+
+static void twi_done(const uint8_t status)
+{
+    TWCR = bit3(TWINT, TWEN, TWSTO);
+    g_twi_status = status;
+    g_twi_busy = false;
+    TWI_DONE_NOTIFY();
+}
+
+
+// Master Transmitter and Master Receiver status codes.
+// [DS40002211A, 24.7.1, 24.7.2, Table 24-3, Table 24-4]
+ISR(TWI_vect)
+{
+    PROFILE_BEGIN();
+    switch(TWSR & 0xF8U) {
+
+        // START or repeated START sent: send SLA+W or SLA+R.
+        case 0x08:
+        case 0x10: {
+            const bool read = !g_twi_scan && g_twi_i == g_twi_tx_n
+                                          && g_twi_rx_n != 0;
+            TWDR = (uint8_t)(g_twi_address << 1U) | (read ? 1U : 0U);
+            if (read) {
+                g_twi_i = 0;
+            }
+            TWCR = TWI_GO;
+            break;
+        }
+
+        // SLA+W or data byte ACKed.
+        case 0x18:
+        case 0x28:
+            if (g_twi_scan) {
+                g_twi_found[g_twi_address >> 3U] |= bit1(g_twi_address & 7U);
+            } else if (g_twi_i < g_twi_tx_n) {
+                TWDR = g_twi_tx[g_twi_i++];
+                TWCR = TWI_GO;
+                break;
+            } else if (g_twi_rx_n != 0) {
+                TWCR = TWI_GO | bit1(TWSTA);
+                break;
+            } else {
+                twi_done(TWI_OK);
+                break;
+            }
+            // Scan: next address, as for a NACK.
+            /* fall through */
+
+        // SLA+W NACKed.
+        case 0x20:
+            if (g_twi_scan) {
+                if (g_twi_address == TWI_SCAN_LAST) {
+                    twi_done(TWI_OK);
+                } else {
+                    g_twi_address++;
+                    TWCR = TWI_GO | bit2(TWSTA, TWSTO);
+                }
+            } else {
+                twi_done(TWI_ADDRESS_NACK);
+            }
+            break;
+
+        case 0x30: twi_done(TWI_DATA_NACK); break;
+        case 0x48: twi_done(TWI_ADDRESS_NACK); break;
+
+        // Release the bus, no STOP.
+        case 0x38:
+            TWCR = bit2(TWINT, TWEN);
+            g_twi_status = TWI_ARBITRATION_LOST;
+            g_twi_busy = false;
+            TWI_DONE_NOTIFY();
+            break;
+
+        // SLA+R ACKed, or data byte received and ACKed: ACK all but the
+        // last byte.
+        case 0x50:
+            g_twi_rx[g_twi_i++] = TWDR;
+            // Fall through.
+        case 0x40:
+            TWCR = TWI_GO | ((g_twi_i + 1U < g_twi_rx_n) ? bit1(TWEA) : 0U);
+            break;
+
+        // Last byte received and NACKed.
+        case 0x58:
+            g_twi_rx[g_twi_i++] = TWDR;
+            twi_done(TWI_OK);
+            break;
+
+        default: twi_done(TWI_BUS_ERROR); break;
+    }
+    PROFILE_END(PROFILE_ISR_TWI);
+}
+
+
+
+/* Control */
+
+// SCL frequency = F_CPU / (16 + 2 * TWBR * 4^TWPS), 8 to 400 kHz.
+// [DS40002211A, 24.5.2, 24.9.1, Table 24-7]
+static void twi_enable(const uint16_t khz)
+{
+    assert(khz >= 8 && khz <= 400, "Bad TWI Clock!");
+    assert(!g_twi_busy, "TWI Busy!");
+
+    uint16_t twbr = (uint16_t)((F_CPU / 1000U / khz - 16U) / 2U);
+    uint8_t twps = 0;
+    if (twbr > 0xFFU) {
+        twbr /= 4U;
+        twps = bit1(TWPS0);
+    }
+
+    PRR0 &= (uint8_t)~bit1(PRTWI);
+    DDRD &= (uint8_t)~bit2(0, 1);
+    PORTD |= bit2(0, 1);
+    TWBR = (uint8_t)twbr;
+    TWSR = twps;
+    TWCR = bit1(TWEN);
+    g_twi_enabled = true;
+}
+
+
+static void twi_disable(void)
+{
+    assert(!g_twi_busy, "TWI Busy!");
+    TWCR = 0;
+    g_twi_enabled = false;
+}
+
+
+// Reset the TWI, releasing SCL and SDA, and finish the transaction with
+// `status`. Called with interrupts disabled.
+static void twi_abort(const uint8_t status)
+{
+    TWCR = 0;
+    TWCR = bit1(TWEN);
+    g_twi_status = status;
+    g_twi_busy = false;
+    TWI_DONE_NOTIFY();
+}
+
+
+static void twi_start(void)
+{
+    assert(g_twi_enabled, "TWI Not Enabled!");
+
+    // Previous STOP still being sent. It can't be sent while another
+    // master or a stuck device holds the bus.
+    g_twi_start_time = ms_clock32();
+    g_twi_response = true;
+    while (TWCR & bit1(TWSTO)) {
+        if (ms_clock32() - g_twi_start_time >= TWI_TIMEOUT_MS) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                twi_abort(TWI_BUS_ERROR);
+            }
+            return;
+        }
+    }
+
+    g_twi_i = 0;
+    g_twi_status = TWI_OK;
+    g_twi_busy = true;
+    TWCR = TWI_GO | bit1(TWSTA);
+}
+
+
+// Abort a stuck transaction.
+static void twi_check_timeout(void)
+{
+    if (!g_twi_busy || ms_clock32() - g_twi_start_time < TWI_TIMEOUT_MS) {
+        return;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (g_twi_busy) {
+            twi_abort(TWI_TIMEOUT);
+        }
+    }
+}
+
+
+static void twi_print_response(void)
+{
+    print_c('>');
+    print_c('Y');
+    if (g_twi_scan) {
+        print_c('S');
+        print_hex(g_twi_status);
+        for (uint8_t i = 0 ; i < sizeof(g_twi_found) ; i++) {
+            print_hex(g_twi_found[i]);
+        }
+    } else {
+        print_c('T');
+        print_hex(g_twi_address);
+        print_hex(g_twi_rx_n);
+        for (uint8_t i = 0 ; i < g_twi_tx_n ; i++) {
+            print_hex(g_twi_tx[i]);
+        }
+        print_hex(g_twi_status);
+        if (g_twi_status == TWI_OK) {
+            for (uint8_t i = 0 ; i < g_twi_rx_n ; i++) {
+                print_hex(g_twi_rx[i]);
+            }
+        }
+    }
+    print_end_of_line();
+}
+
+
+// Send the response of a finished transaction.
+// Returns false while a transaction is running.
+static bool twi_poll(void)
+{
+    if (g_twi_busy) {
+        return false;
+    }
+    if (g_twi_response) {
+        g_twi_response = false;
+        twi_print_response();
+    }
+    return true;
+}
+
+
+
+/* Commands */
+
+// YC<khz:4>                        Enable at <khz> (8-400) SCL clock.
+// YT<address:2><n:2><bytes:2m>     Write m bytes (0-TWI_BUFFER_SIZE) to
+//                                  7-bit <address>, then repeated START
+//                                  and read n bytes (0-TWI_BUFFER_SIZE).
+// YS                               Scan addresses 0x08-0x77.
+// YX                               Disable.
+//
+// YT responds with <status:2> then (if OK) the bytes read.
+// YS responds with <status:2> then a 128 bit map of the addresses that
+// ACKed (2 hex digits per 8 addresses, address 0 first, LSB first).
+// Status: 0 OK, 1 address NACK, 2 data NACK, 3 arbitration lost,
+// 4 bus error, 5 timeout.
+static void twi_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 2, "Short TWI Command!");
+
+    switch(p[1]) {
+        case 'C': assert(l == 6, "Bad TWI Config!");
+                  twi_enable((uint16_t)parse_hex(p + 2, 4));
+                  break;
+        case 'T': assert(l >= 6 && (l & 1U) == 0, "Bad TWI Transaction!");
+                  g_twi_address = (uint8_t)parse_hex(p + 2, 2);
+                  g_twi_rx_n = (uint8_t)parse_hex(p + 4, 2);
+                  g_twi_tx_n = (uint8_t)((l - 6U) / 2U);
+                  assert(g_twi_address < 0x80U, "Bad TWI Address!");
+                  assert(g_twi_tx_n + g_twi_rx_n != 0, "Empty TWI Transaction!");
+                  assert(g_twi_tx_n <= TWI_BUFFER_SIZE
+                      && g_twi_rx_n <= TWI_BUFFER_SIZE, "TWI Transfer Too Long!");
+                  for (uint8_t i = 0 ; i < g_twi_tx_n ; i++) {
+                      g_twi_tx[i] = (uint8_t)parse_hex(p + 6 + 2 * i, 2);
+                  }
+                  g_twi_scan = false;
+                  twi_start();
+                  return;
+        case 'S': assert(l == 2, "Bad TWI Scan!");
+                  for (uint8_t i = 0 ; i < sizeof(g_twi_found) ; i++) {
+                      g_twi_found[i] = 0;
+                  }
+                  g_twi_address = TWI_SCAN_FIRST;
+                  g_twi_scan = true;
+                  twi_start();
+                  return;
+        case 'X': twi_disable(); break;
+        default: assert(0, "Bad TWI Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    print_end_of_line();
+}
+
+
+
+#endif // AVR_TWI_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,148 @@
+//==============================================================================
+// AVR USART Driver.
+//
+// AVR_USART(n, prr) defines the driver for USARTn, with PRUSARTn in Power
+// Reduction Register `prr`. All four USARTs share this one definition; each
+// instance uses its own registers and FIFOs directly, so the ISRs are as
+// specialised as hand written ones.
+//
+// Before AVR_USART(n, prr) define:
+//
+//   USARTn_RX_NOTIFY()     Called from the RX ISR after each received byte.
+//   USARTn_RX_FIFO_SIZE    Default FIFO sizes, see fifo_arena.h.
+//   USARTn_TX_FIFO_SIZE
+//
+// Defines:
+//
+//   usartn_init()          38400 bps, 8N1, RX interrupt enabled.
+//   usartn_tx(c)           Put byte into TX FIFO.
+//   p_g_usartn_rx_fifo     Allocated from the FIFO arena, see fifo_arena.h.
+//   p_g_usartn_tx_fifo
+//   ISR(USARTn_RX_vect)    Store received byte in RX FIFO, oldest byte is
+//                          dropped when full.
+//   ISR(USARTn_UDRE_vect)  Send byte from TX FIFO.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef AVR_USART_H_INCLUDED
+#define AVR_USART_H_INCLUDED
+
+
+// UBRRn value for 38400 bps is 25 (U2Xn = 0, 16 MHz system clock)
+// [DS40002211A, Table 22-11, p223]
+//
+// Wake USARTn via Power Reduction Register.
+// [DS40002211A, 11.10.3, p56]
+//
+// Enable RX/TX and RX Interrupt.
+// [DS40002211A, 22.10.3, p220]
+//
+// 8 data bits, no parity, 1 stop bit.
+// [DS40002211A, 22.10.4, p221]
+//
+// If interrupts are globally disabled usartn_tx() sends bytes directly
+// to UDRn.
+
+#define AVR_USART(n, prr) \
+\
+static void usart##n##_set_16_mhz_38400_bps(void) \
+{ \
+    UBRR##n##H = 0U; \
+    UBRR##n##L = 25U; \
+} \
+\
+static void usart##n##_power_on(void) \
+{ \
+    prr &= (uint8_t)~bit1(PRUSART##n); \
+} \
+\
+static void usart##n##_enable(void) \
+{ \
+    UCSR##n##B = bit3(RXCIE##n, RXEN##n, TXEN##n); \
+} \
+\
+static void usart##n##_set_8n1(void) \
+{ \
+    UCSR##n##C = bit2(UCSZ##n##1, UCSZ##n##0); \
+} \
+\
+static void usart##n##_init(void) \
+{ \
+    usart##n##_set_16_mhz_38400_bps(); \
+    usart##n##_set_8n1(); \
+    usart##n##_power_on(); \
+    usart##n##_enable(); \
+} \
+\
+\
+static fifo_t* p_g_usart##n##_rx_fifo; \
+\
+ISR(USART##n##_RX_vect) \
+{ \
+    PROFILE_BEGIN(); \
+    if (fifo_is_full(p_g_usart##n##_rx_fifo)) { \
+        fifo_read(p_g_usart##n##_rx_fifo); \
+    } \
+    fifo_write(p_g_usart##n##_rx_fifo, UDR##n); \
+    USART##n##_RX_NOTIFY(); \
+    PROFILE_END(PROFILE_ISR_USART##n##_RX); \
+} \
+\
+\
+static void usart##n##_tx_interrupt_enable(void) \
+{ \
+    UCSR##n##B |= bit1(UDRIE##n); \
+} \
+\
+static void usart##n##_tx_interrupt_disable(void) \
+{ \
+    UCSR##n##B &= (uint8_t)~bit1(UDRIE##n); \
+} \
+\
+static fifo_t* p_g_usart##n##_tx_fifo; \
+\
+ISR(USART##n##_UDRE_vect) \
+{ \
+    PROFILE_BEGIN(); \
+    if (fifo_is_not_empty(p_g_usart##n##_tx_fifo)) { \
+        UDR##n = fifo_read(p_g_usart##n##_tx_fifo); \
+    } else { \
+        usart##n##_tx_interrupt_disable(); \
+    } \
+    PROFILE_END(PROFILE_ISR_USART##n##_TX); \
+} \
+\
+static bool usart##n##_tx_is_empty(void) \
+{ \
+    return UCSR##n##A & bit1(UDRE##n); \
+} \
+\
+static bool usart##n##_tx_is_not_empty(void) \
+{ \
+    return !usart##n##_tx_is_empty(); \
+} \
+\
+static void usart##n##_tx(const uint8_t c) \
+{ \
+    fifo_write(p_g_usart##n##_tx_fifo, c); \
+    if ((SREG & bit1(SREG_I)) == 0) { \
+        while (fifo_is_not_empty(p_g_usart##n##_tx_fifo)) { \
+            while (usart##n##_tx_is_not_empty()) {}; \
+            UDR##n = fifo_read(p_g_usart##n##_tx_fifo); \
+        } \
+    } else { \
+        usart##n##_tx_interrupt_enable(); \
+    } \
+}
+
+
+
+#endif // AVR_USART_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
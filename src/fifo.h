@@ -8,11 +8,20 @@
 #define FIFO_H_INCLUDED
 
 
+// Called while waiting for an ISR to read or write the FIFO.
+#ifndef FIFO_WAIT
+#define FIFO_WAIT()
+#endif
+
+
 typedef struct fifo
 {
     volatile uint8_t in;
     volatile uint8_t out;
-    const uint8_t size;
+    uint8_t size;
+#ifdef PROFILE
+    uint8_t peak;                   // Highest fill level seen.
+#endif
     uint8_t buf[];
 } fifo_t;
 
@@ -22,12 +31,37 @@ typedef struct fifo
         {.fifo = {.size = (static_size)}})
 
 
+// Make an empty FIFO of `size` bytes at `p`, which must have room for
+// sizeof(fifo_t) + size bytes.
+static fifo_t* fifo_init(void* const p, const uint8_t size)
+{
+    fifo_t* const fifo = (fifo_t*)p;
+    fifo->in = 0;
+    fifo->out = 0;
+    fifo->size = size;
+#ifdef PROFILE
+    fifo->peak = 0;
+#endif
+    return fifo;
+}
+
+
 static uint8_t next_fifo_i(const fifo_t* const p, uint8_t i)
 {
     return (uint8_t)(++i % p->size);
 }
 
 
+#ifdef PROFILE
+static uint8_t fifo_level(const fifo_t* const p)
+{
+    const uint8_t in = p->in;
+    const uint8_t out = p->out;
+    return in >= out ? in - out : (uint8_t)(p->size - out + in);
+}
+#endif
+
+
 static bool fifo_is_empty(const fifo_t* const p)
 {
     return p->in == p->out;
@@ -54,7 +88,7 @@ bool fifo_is_not_full(const fifo_t* const p)
 static uint8_t fifo_read(fifo_t* const p)
 {
     while (fifo_is_empty(p)) {
-        // Wait.
+        FIFO_WAIT();
     }
 
     /* local scope */ {
@@ -69,7 +103,7 @@ static uint8_t fifo_read(fifo_t* const p)
 static void fifo_write(fifo_t* const p, const uint8_t c)
 {
     while (fifo_is_full(p)) {
-        // Wait.
+        FIFO_WAIT();
     }
 
     /* local scope */ {
@@ -77,6 +111,13 @@ static void fifo_write(fifo_t* const p, const uint8_t c)
         p->buf[i] = c;
         p->in = next_fifo_i(p, i);
     }
+
+#ifdef PROFILE
+    const uint8_t level = fifo_level(p);
+    if (level > p->peak) {
+        p->peak = level;
+    }
+#endif
 }
 
 
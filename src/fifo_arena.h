@@ -0,0 +1,181 @@
+//==============================================================================
+// USART FIFO Arena.
+//
+// The RX and TX FIFOs of all four USARTs are carved out of one SRAM arena
+// at boot, so buffer space can go to the ports that need it. The layout
+// is kept in EEPROM and takes effect at the next reset ("Z"). A USART
+// given no FIFO space is left powered down and cannot be written to.
+//
+// Each FIFO holds up to 255 bytes (8-bit indices, so the ISRs stay
+// short). USART0 (the host link) always keeps at least
+// FIFO_ARENA_USART0_MIN bytes each way.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef FIFO_ARENA_H_INCLUDED
+#define FIFO_ARENA_H_INCLUDED
+
+
+// FIFO bytes, not counting the FIFO headers.
+#ifndef FIFO_ARENA_SIZE
+#define FIFO_ARENA_SIZE 768
+#endif
+
+#define FIFO_ARENA_FIFOS 8
+#define FIFO_ARENA_USART0_MIN 16U
+#define FIFO_ARENA_MAGIC 0xF1F0U
+
+
+// FIFO sizes in order USART0 RX, TX, USART1 RX, TX, ... USART3 RX, TX.
+typedef struct {
+    uint16_t magic;
+    uint8_t size[FIFO_ARENA_FIFOS];
+    uint8_t check;                  // Sum of sizes, inverted.
+} fifo_arena_layout_t;
+
+
+static uint8_t g_fifo_arena[FIFO_ARENA_SIZE
+                            + FIFO_ARENA_FIFOS * sizeof(fifo_t)];
+
+static fifo_arena_layout_t g_fifo_arena_layout;
+
+static fifo_arena_layout_t g_fifo_arena_eeprom EEMEM;
+
+// Stands in for the FIFOs of an unused USART: always empty.
+static fifo_t g_fifo_none = {.size = 1};
+
+static fifo_t** const g_fifo_arena_fifos[FIFO_ARENA_FIFOS] = {
+    &p_g_usart0_rx_fifo, &p_g_usart0_tx_fifo,
+    &p_g_usart1_rx_fifo, &p_g_usart1_tx_fifo,
+    &p_g_usart2_rx_fifo, &p_g_usart2_tx_fifo,
+    &p_g_usart3_rx_fifo, &p_g_usart3_tx_fifo
+};
+
+
+static uint8_t fifo_arena_check(const fifo_arena_layout_t* const layout)
+{
+    uint8_t sum = 0;
+    for (uint8_t i = 0 ; i < FIFO_ARENA_FIFOS ; i++) {
+        sum += layout->size[i];
+    }
+    return (uint8_t)~sum;
+}
+
+
+// Sizes are 0 or 2-255 (a FIFO of size n holds n - 1 bytes), a USART's
+// RX and TX FIFOs are both used or both unused, and they all fit.
+static bool fifo_arena_is_valid(const uint8_t* const size)
+{
+    uint16_t total = 0;
+    for (uint8_t i = 0 ; i < FIFO_ARENA_FIFOS ; i++) {
+        if (size[i] == 1 || (size[i] == 0) != (size[i ^ 1U] == 0)) {
+            return false;
+        }
+        total += size[i];
+    }
+    return size[0] >= FIFO_ARENA_USART0_MIN
+        && size[1] >= FIFO_ARENA_USART0_MIN
+        && total <= FIFO_ARENA_SIZE;
+}
+
+
+// Call at boot, before the USARTs are enabled.
+static void fifo_arena_init(void)
+{
+    eeprom_read_block(&g_fifo_arena_layout, &g_fifo_arena_eeprom,
+                      sizeof(g_fifo_arena_layout));
+
+    fifo_arena_layout_t* const layout = &g_fifo_arena_layout;
+    if (layout->magic != FIFO_ARENA_MAGIC
+    ||  layout->check != fifo_arena_check(layout)
+    ||  !fifo_arena_is_valid(layout->size)) {
+        const uint8_t size[FIFO_ARENA_FIFOS] = {
+            USART0_RX_FIFO_SIZE, USART0_TX_FIFO_SIZE,
+            USART1_RX_FIFO_SIZE, USART1_TX_FIFO_SIZE,
+            USART2_RX_FIFO_SIZE, USART2_TX_FIFO_SIZE,
+            USART3_RX_FIFO_SIZE, USART3_TX_FIFO_SIZE
+        };
+        for (uint8_t i = 0 ; i < FIFO_ARENA_FIFOS ; i++) {
+            layout->size[i] = size[i];
+        }
+    }
+
+    uint8_t* p = g_fifo_arena;
+    for (uint8_t i = 0 ; i < FIFO_ARENA_FIFOS ; i++) {
+        const uint8_t size = layout->size[i];
+        if (size == 0) {
+            *g_fifo_arena_fifos[i] = &g_fifo_none;
+        } else {
+            *g_fifo_arena_fifos[i] = fifo_init(p, size);
+            p += sizeof(fifo_t) + size;
+        }
+    }
+}
+
+
+// USART '0'-'3' has FIFOs.
+static bool fifo_arena_usart_is_used(const uint8_t usart)
+{
+    return g_fifo_arena_layout.size[2U * (usart - (uint8_t)'0')] != 0;
+}
+
+
+// FIFO size of `i` in the arena, 0 if unused.
+static uint8_t fifo_arena_size(const uint8_t i)
+{
+    return g_fifo_arena_layout.size[i];
+}
+
+
+// Bytes of the arena in use.
+static uint16_t fifo_arena_used(void)
+{
+    uint16_t total = 0;
+    for (uint8_t i = 0 ; i < FIFO_ARENA_FIFOS ; i++) {
+        total += g_fifo_arena_layout.size[i];
+    }
+    return total;
+}
+
+
+
+/* Commands */
+
+// GF                   Respond with the FIFO sizes in use.
+// GF<size:2 × 8>       Save FIFO sizes (USART0 RX, TX, ... USART3 RX, TX)
+//                      in EEPROM for the next reset.
+//
+// Both respond with the sizes in use, then the arena size <bytes:4> and
+// the bytes of it in use <bytes:4>.
+static void fifo_arena_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l == 2 || l == 2 + 2 * FIFO_ARENA_FIFOS, "Bad FIFO Command!");
+
+    if (l != 2) {
+        fifo_arena_layout_t layout = {.magic = FIFO_ARENA_MAGIC};
+        for (uint8_t i = 0 ; i < FIFO_ARENA_FIFOS ; i++) {
+            layout.size[i] = (uint8_t)parse_hex(p + 2 + 2 * i, 2);
+        }
+        assert(fifo_arena_is_valid(layout.size), "Bad FIFO Sizes!");
+        layout.check = fifo_arena_check(&layout);
+        eeprom_update_block(&layout, &g_fifo_arena_eeprom, sizeof(layout));
+    }
+
+    print_c('>');
+    print_n(p, l);
+    for (uint8_t i = 0 ; i < FIFO_ARENA_FIFOS ; i++) {
+        print_hex(fifo_arena_size(i));
+    }
+    print_hex16(FIFO_ARENA_SIZE);
+    print_hex16(fifo_arena_used());
+    print_end_of_line();
+}
+
+
+
+#endif // FIFO_ARENA_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,28 @@
+//==============================================================================
+// Host Mock of <avr/eeprom.h>.
+//
+// EEPROM variables are ordinary variables on the host, so they keep their
+// value across a mock watchdog reset but not across runs.
+//
+
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef MOCK_AVR_EEPROM_H_INCLUDED
+#define MOCK_AVR_EEPROM_H_INCLUDED
+
+#include <string.h>
+
+
+#define EEMEM
+
+#define eeprom_read_block(dst, src, n) memcpy((dst), (src), (n))
+#define eeprom_update_block(src, dst, n) memcpy((dst), (src), (n))
+
+
+
+#endif // MOCK_AVR_EEPROM_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
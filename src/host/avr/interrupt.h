@@ -0,0 +1,25 @@
+//==============================================================================
+// Host Mock of <avr/interrupt.h>.
+//
+// ISRs are plain functions, called by the harness.
+//
+
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef MOCK_AVR_INTERRUPT_H_INCLUDED
+#define MOCK_AVR_INTERRUPT_H_INCLUDED
+
+
+#define ISR(vector, ...) void vector(void)
+#define ISR_NOBLOCK
+#define sei() (SREG |= (uint8_t)(1U << SREG_I))
+#define cli() (SREG &= (uint8_t)~(1U << SREG_I))
+
+
+
+#endif // MOCK_AVR_INTERRUPT_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,644 @@
+//==============================================================================
+// Host Mock of <avr/io.h> for the ATmega2560.
+//
+// Each I/O register is a plain variable, so firmware can be compiled and
+// run on the build host. ADCSRA clears ADSC when read, so a conversion
+// completes immediately. SPSR sets SPIF when read, so an SPI byte
+// completes immediately, and SPDR loops MOSI back to MISO. TWCR clears
+// TWSTO when read. UDRn holds MOCK_UDR_EMPTY until written; a byte the
+// firmware writes with interrupts disabled (no UDRE ISR) is sent when
+// UCSRnA is next read, see mock_udr_flush() in harness.h. UCSRnA, PINx
+// etc. are set by the harness.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef MOCK_AVR_IO_H_INCLUDED
+#define MOCK_AVR_IO_H_INCLUDED
+
+#include <stdint.h>
+
+
+/* 8-bit registers */
+static volatile uint8_t mock_PINA;
+#define PINA mock_PINA
+static volatile uint8_t mock_DDRA;
+#define DDRA mock_DDRA
+static volatile uint8_t mock_PORTA;
+#define PORTA mock_PORTA
+static volatile uint8_t mock_PINB;
+#define PINB mock_PINB
+static volatile uint8_t mock_DDRB;
+#define DDRB mock_DDRB
+static volatile uint8_t mock_PORTB;
+#define PORTB mock_PORTB
+static volatile uint8_t mock_PINC;
+#define PINC mock_PINC
+static volatile uint8_t mock_DDRC;
+#define DDRC mock_DDRC
+static volatile uint8_t mock_PORTC;
+#define PORTC mock_PORTC
+static volatile uint8_t mock_PIND;
+#define PIND mock_PIND
+static volatile uint8_t mock_DDRD;
+#define DDRD mock_DDRD
+static volatile uint8_t mock_PORTD;
+#define PORTD mock_PORTD
+static volatile uint8_t mock_PINE;
+#define PINE mock_PINE
+static volatile uint8_t mock_DDRE;
+#define DDRE mock_DDRE
+static volatile uint8_t mock_PORTE;
+#define PORTE mock_PORTE
+static volatile uint8_t mock_PINF;
+#define PINF mock_PINF
+static volatile uint8_t mock_DDRF;
+#define DDRF mock_DDRF
+static volatile uint8_t mock_PORTF;
+#define PORTF mock_PORTF
+static volatile uint8_t mock_PING;
+#define PING mock_PING
+static volatile uint8_t mock_DDRG;
+#define DDRG mock_DDRG
+static volatile uint8_t mock_PORTG;
+#define PORTG mock_PORTG
+static volatile uint8_t mock_PINH;
+#define PINH mock_PINH
+static volatile uint8_t mock_DDRH;
+#define DDRH mock_DDRH
+static volatile uint8_t mock_PORTH;
+#define PORTH mock_PORTH
+static volatile uint8_t mock_PINJ;
+#define PINJ mock_PINJ
+static volatile uint8_t mock_DDRJ;
+#define DDRJ mock_DDRJ
+static volatile uint8_t mock_PORTJ;
+#define PORTJ mock_PORTJ
+static volatile uint8_t mock_PINK;
+#define PINK mock_PINK
+static volatile uint8_t mock_DDRK;
+#define DDRK mock_DDRK
+static volatile uint8_t mock_PORTK;
+#define PORTK mock_PORTK
+static volatile uint8_t mock_PINL;
+#define PINL mock_PINL
+static volatile uint8_t mock_DDRL;
+#define DDRL mock_DDRL
+static volatile uint8_t mock_PORTL;
+#define PORTL mock_PORTL
+static volatile uint8_t mock_SREG;
+#define SREG mock_SREG
+static volatile uint8_t mock_ADCSRA;
+static volatile uint8_t* mock_adcsra(void)
+{
+    mock_ADCSRA &= (uint8_t)~(1U << 6);
+    return &mock_ADCSRA;
+}
+#define ADCSRA (*mock_adcsra())
+static volatile uint8_t mock_ADCSRB;
+#define ADCSRB mock_ADCSRB
+static volatile uint8_t mock_ADMUX;
+#define ADMUX mock_ADMUX
+static volatile uint8_t mock_DIDR0;
+#define DIDR0 mock_DIDR0
+static volatile uint8_t mock_DIDR2;
+#define DIDR2 mock_DIDR2
+static volatile uint8_t mock_PRR0;
+#define PRR0 mock_PRR0
+static volatile uint8_t mock_PRR1;
+#define PRR1 mock_PRR1
+static volatile uint8_t mock_MCUSR;
+#define MCUSR mock_MCUSR
+static volatile uint8_t mock_SMCR;
+#define SMCR mock_SMCR
+static volatile uint8_t mock_SPL;
+#define SPL mock_SPL
+static volatile uint8_t mock_SPH;
+#define SPH mock_SPH
+#define MOCK_UDR_EMPTY 0x100U
+static void mock_udr_flush(uint8_t n);
+static volatile uint8_t* mock_ucsra(const uint8_t n, volatile uint8_t* const p)
+{
+    mock_udr_flush(n);
+    return p;
+}
+static volatile uint8_t mock_UBRR0H;
+#define UBRR0H mock_UBRR0H
+static volatile uint8_t mock_UBRR0L;
+#define UBRR0L mock_UBRR0L
+static volatile uint8_t mock_UCSR0A;
+#define UCSR0A (*mock_ucsra(0, &mock_UCSR0A))
+static volatile uint8_t mock_UCSR0B;
+#define UCSR0B mock_UCSR0B
+static volatile uint8_t mock_UCSR0C;
+#define UCSR0C mock_UCSR0C
+static volatile uint16_t mock_UDR0 = MOCK_UDR_EMPTY;
+#define UDR0 mock_UDR0
+static volatile uint8_t mock_UBRR1H;
+#define UBRR1H mock_UBRR1H
+static volatile uint8_t mock_UBRR1L;
+#define UBRR1L mock_UBRR1L
+static volatile uint8_t mock_UCSR1A;
+#define UCSR1A (*mock_ucsra(1, &mock_UCSR1A))
+static volatile uint8_t mock_UCSR1B;
+#define UCSR1B mock_UCSR1B
+static volatile uint8_t mock_UCSR1C;
+#define UCSR1C mock_UCSR1C
+static volatile uint16_t mock_UDR1 = MOCK_UDR_EMPTY;
+#define UDR1 mock_UDR1
+static volatile uint8_t mock_UBRR2H;
+#define UBRR2H mock_UBRR2H
+static volatile uint8_t mock_UBRR2L;
+#define UBRR2L mock_UBRR2L
+static volatile uint8_t mock_UCSR2A;
+#define UCSR2A (*mock_ucsra(2, &mock_UCSR2A))
+static volatile uint8_t mock_UCSR2B;
+#define UCSR2B mock_UCSR2B
+static volatile uint8_t mock_UCSR2C;
+#define UCSR2C mock_UCSR2C
+static volatile uint16_t mock_UDR2 = MOCK_UDR_EMPTY;
+#define UDR2 mock_UDR2
+static volatile uint8_t mock_UBRR3H;
+#define UBRR3H mock_UBRR3H
+static volatile uint8_t mock_UBRR3L;
+#define UBRR3L mock_UBRR3L
+static volatile uint8_t mock_UCSR3A;
+#define UCSR3A (*mock_ucsra(3, &mock_UCSR3A))
+static volatile uint8_t mock_UCSR3B;
+#define UCSR3B mock_UCSR3B
+static volatile uint8_t mock_UCSR3C;
+#define UCSR3C mock_UCSR3C
+static volatile uint16_t mock_UDR3 = MOCK_UDR_EMPTY;
+#define UDR3 mock_UDR3
+static volatile uint8_t mock_TCCR0A;
+#define TCCR0A mock_TCCR0A
+static volatile uint8_t mock_TCCR0B;
+#define TCCR0B mock_TCCR0B
+static volatile uint8_t mock_TCNT0;
+#define TCNT0 mock_TCNT0
+static volatile uint8_t mock_OCR0A;
+#define OCR0A mock_OCR0A
+static volatile uint8_t mock_OCR0B;
+#define OCR0B mock_OCR0B
+static volatile uint8_t mock_TIMSK0;
+#define TIMSK0 mock_TIMSK0
+static volatile uint8_t mock_TIFR0;
+#define TIFR0 mock_TIFR0
+static volatile uint8_t mock_TCCR2A;
+#define TCCR2A mock_TCCR2A
+static volatile uint8_t mock_TCCR2B;
+#define TCCR2B mock_TCCR2B
+static volatile uint8_t mock_TCNT2;
+#define TCNT2 mock_TCNT2
+static volatile uint8_t mock_OCR2A;
+#define OCR2A mock_OCR2A
+static volatile uint8_t mock_OCR2B;
+#define OCR2B mock_OCR2B
+static volatile uint8_t mock_TIMSK2;
+#define TIMSK2 mock_TIMSK2
+static volatile uint8_t mock_TIFR2;
+#define TIFR2 mock_TIFR2
+static volatile uint8_t mock_ASSR;
+#define ASSR mock_ASSR
+static volatile uint8_t mock_GTCCR;
+#define GTCCR mock_GTCCR
+static volatile uint8_t mock_TCCR1A;
+#define TCCR1A mock_TCCR1A
+static volatile uint8_t mock_TCCR1B;
+#define TCCR1B mock_TCCR1B
+static volatile uint8_t mock_TCCR1C;
+#define TCCR1C mock_TCCR1C
+static volatile uint8_t mock_TIMSK1;
+#define TIMSK1 mock_TIMSK1
+static volatile uint8_t mock_TIFR1;
+#define TIFR1 mock_TIFR1
+static volatile uint8_t mock_TCCR3A;
+#define TCCR3A mock_TCCR3A
+static volatile uint8_t mock_TCCR3B;
+#define TCCR3B mock_TCCR3B
+static volatile uint8_t mock_TCCR3C;
+#define TCCR3C mock_TCCR3C
+static volatile uint8_t mock_TIMSK3;
+#define TIMSK3 mock_TIMSK3
+static volatile uint8_t mock_TIFR3;
+#define TIFR3 mock_TIFR3
+static volatile uint8_t mock_TCCR4A;
+#define TCCR4A mock_TCCR4A
+static volatile uint8_t mock_TCCR4B;
+#define TCCR4B mock_TCCR4B
+static volatile uint8_t mock_TCCR4C;
+#define TCCR4C mock_TCCR4C
+static volatile uint8_t mock_TIMSK4;
+#define TIMSK4 mock_TIMSK4
+static volatile uint8_t mock_TIFR4;
+#define TIFR4 mock_TIFR4
+static volatile uint8_t mock_TCCR5A;
+#define TCCR5A mock_TCCR5A
+static volatile uint8_t mock_TCCR5B;
+#define TCCR5B mock_TCCR5B
+static volatile uint8_t mock_TCCR5C;
+#define TCCR5C mock_TCCR5C
+static volatile uint8_t mock_TIMSK5;
+#define TIMSK5 mock_TIMSK5
+static volatile uint8_t mock_TIFR5;
+#define TIFR5 mock_TIFR5
+static volatile uint8_t mock_EICRA;
+#define EICRA mock_EICRA
+static volatile uint8_t mock_EICRB;
+#define EICRB mock_EICRB
+static volatile uint8_t mock_EIMSK;
+#define EIMSK mock_EIMSK
+static volatile uint8_t mock_EIFR;
+#define EIFR mock_EIFR
+static volatile uint8_t mock_PCICR;
+#define PCICR mock_PCICR
+static volatile uint8_t mock_PCIFR;
+#define PCIFR mock_PCIFR
+static volatile uint8_t mock_PCMSK0;
+#define PCMSK0 mock_PCMSK0
+static volatile uint8_t mock_PCMSK1;
+#define PCMSK1 mock_PCMSK1
+static volatile uint8_t mock_PCMSK2;
+#define PCMSK2 mock_PCMSK2
+static volatile uint8_t mock_SPCR;
+#define SPCR mock_SPCR
+static volatile uint8_t mock_SPSR;
+static volatile uint8_t* mock_spsr(void)
+{
+    mock_SPSR |= (uint8_t)(1U << 7);
+    return &mock_SPSR;
+}
+#define SPSR (*mock_spsr())
+static volatile uint8_t mock_SPDR;
+#define SPDR mock_SPDR
+static volatile uint8_t mock_TWBR;
+#define TWBR mock_TWBR
+static volatile uint8_t mock_TWSR;
+#define TWSR mock_TWSR
+static volatile uint8_t mock_TWCR;
+static volatile uint8_t* mock_twcr(void)
+{
+    mock_TWCR &= (uint8_t)~(1U << 4);
+    return &mock_TWCR;
+}
+#define TWCR (*mock_twcr())
+static volatile uint8_t mock_TWDR;
+#define TWDR mock_TWDR
+static volatile uint8_t mock_TWAR;
+#define TWAR mock_TWAR
+static volatile uint8_t mock_TWAMR;
+#define TWAMR mock_TWAMR
+
+
+/* 16-bit registers */
+
+static volatile uint16_t mock_ADC;
+#define ADC mock_ADC
+static volatile uint16_t mock_TCNT1;
+#define TCNT1 mock_TCNT1
+static volatile uint16_t mock_OCR1A;
+#define OCR1A mock_OCR1A
+static volatile uint16_t mock_OCR1B;
+#define OCR1B mock_OCR1B
+static volatile uint16_t mock_OCR1C;
+#define OCR1C mock_OCR1C
+static volatile uint16_t mock_ICR1;
+#define ICR1 mock_ICR1
+static volatile uint16_t mock_TCNT3;
+#define TCNT3 mock_TCNT3
+static volatile uint16_t mock_OCR3A;
+#define OCR3A mock_OCR3A
+static volatile uint16_t mock_OCR3B;
+#define OCR3B mock_OCR3B
+static volatile uint16_t mock_OCR3C;
+#define OCR3C mock_OCR3C
+static volatile uint16_t mock_ICR3;
+#define ICR3 mock_ICR3
+static volatile uint16_t mock_TCNT4;
+#define TCNT4 mock_TCNT4
+static volatile uint16_t mock_OCR4A;
+#define OCR4A mock_OCR4A
+static volatile uint16_t mock_OCR4B;
+#define OCR4B mock_OCR4B
+static volatile uint16_t mock_OCR4C;
+#define OCR4C mock_OCR4C
+static volatile uint16_t mock_ICR4;
+#define ICR4 mock_ICR4
+static volatile uint16_t mock_TCNT5;
+#define TCNT5 mock_TCNT5
+static volatile uint16_t mock_OCR5A;
+#define OCR5A mock_OCR5A
+static volatile uint16_t mock_OCR5B;
+#define OCR5B mock_OCR5B
+static volatile uint16_t mock_OCR5C;
+#define OCR5C mock_OCR5C
+static volatile uint16_t mock_ICR5;
+#define ICR5 mock_ICR5
+
+
+/* Bits */
+
+#define SREG_I 7
+#define WDRF 3
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define MUX5 3
+#define ACME 6
+#define PRTWI 7
+#define PRTIM2 6
+#define PRTIM0 5
+#define PRTIM1 3
+#define PRSPI 2
+#define PRUSART0 1
+#define PRADC 0
+#define PRTIM5 5
+#define PRTIM4 4
+#define PRTIM3 3
+#define PRUSART3 2
+#define PRUSART2 1
+#define PRUSART1 0
+#define WGM21 1
+#define WGM20 0
+#define WGM22 3
+#define CS22 2
+#define CS21 1
+#define CS20 0
+#define OCIE2B 2
+#define OCIE2A 1
+#define TOIE2 0
+#define OCF2B 2
+#define OCF2A 1
+#define TOV2 0
+#define WGM01 1
+#define WGM00 0
+#define WGM02 3
+#define CS02 2
+#define CS01 1
+#define CS00 0
+#define OCIE0B 2
+#define OCIE0A 1
+#define TOIE0 0
+#define OCF0A 1
+#define TOV0 0
+#define COM0A1 7
+#define COM0A0 6
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+#define SPIE 7
+#define SPE 6
+#define DORD 5
+#define MSTR 4
+#define CPOL 3
+#define CPHA 2
+#define SPR1 1
+#define SPR0 0
+#define SPIF 7
+#define WCOL 6
+#define SPI2X 0
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC 3
+#define TWEN 2
+#define TWIE 0
+#define TWPS1 1
+#define TWPS0 0
+#define INT7 7
+#define INT6 6
+#define INT5 5
+#define INT4 4
+#define INT3 3
+#define INT2 2
+#define INT1 1
+#define INT0 0
+#define INTF7 7
+#define INTF6 6
+#define INTF5 5
+#define INTF4 4
+#define INTF3 3
+#define INTF2 2
+#define INTF1 1
+#define INTF0 0
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+#define ISC20 4
+#define ISC21 5
+#define ISC30 6
+#define ISC31 7
+#define ISC40 0
+#define ISC41 1
+#define ISC50 2
+#define ISC51 3
+#define ISC60 4
+#define ISC61 5
+#define ISC70 6
+#define ISC71 7
+#define PCIE2 2
+#define PCIE1 1
+#define PCIE0 0
+#define PCIF2 2
+#define PCIF1 1
+#define PCIF0 0
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ02 2
+#define UCSZ01 2
+#define UCSZ00 1
+#define USBS0 3
+#define UPM01 5
+#define UPM00 4
+#define RXC1 7
+#define TXC1 6
+#define UDRE1 5
+#define FE1 4
+#define DOR1 3
+#define UPE1 2
+#define U2X1 1
+#define RXCIE1 7
+#define TXCIE1 6
+#define UDRIE1 5
+#define RXEN1 4
+#define TXEN1 3
+#define UCSZ12 2
+#define UCSZ11 2
+#define UCSZ10 1
+#define USBS1 3
+#define UPM11 5
+#define UPM10 4
+#define RXC2 7
+#define TXC2 6
+#define UDRE2 5
+#define FE2 4
+#define DOR2 3
+#define UPE2 2
+#define U2X2 1
+#define RXCIE2 7
+#define TXCIE2 6
+#define UDRIE2 5
+#define RXEN2 4
+#define TXEN2 3
+#define UCSZ22 2
+#define UCSZ21 2
+#define UCSZ20 1
+#define USBS2 3
+#define UPM21 5
+#define UPM20 4
+#define RXC3 7
+#define TXC3 6
+#define UDRE3 5
+#define FE3 4
+#define DOR3 3
+#define UPE3 2
+#define U2X3 1
+#define RXCIE3 7
+#define TXCIE3 6
+#define UDRIE3 5
+#define RXEN3 4
+#define TXEN3 3
+#define UCSZ32 2
+#define UCSZ31 2
+#define UCSZ30 1
+#define USBS3 3
+#define UPM31 5
+#define UPM30 4
+#define COM1A1 7
+#define COM1A0 6
+#define COM1B1 5
+#define COM1B0 4
+#define COM1C1 3
+#define COM1C0 2
+#define WGM11 1
+#define WGM10 0
+#define ICNC1 7
+#define ICES1 6
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+#define ICIE1 5
+#define OCIE1C 3
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1 0
+#define ICF1 5
+#define OCF1C 3
+#define OCF1B 2
+#define OCF1A 1
+#define TOV1 0
+#define FOC1A 7
+#define COM3A1 7
+#define COM3A0 6
+#define COM3B1 5
+#define COM3B0 4
+#define COM3C1 3
+#define COM3C0 2
+#define WGM31 1
+#define WGM30 0
+#define ICNC3 7
+#define ICES3 6
+#define WGM33 4
+#define WGM32 3
+#define CS32 2
+#define CS31 1
+#define CS30 0
+#define ICIE3 5
+#define OCIE3C 3
+#define OCIE3B 2
+#define OCIE3A 1
+#define TOIE3 0
+#define ICF3 5
+#define OCF3C 3
+#define OCF3B 2
+#define OCF3A 1
+#define TOV3 0
+#define FOC3A 7
+#define COM4A1 7
+#define COM4A0 6
+#define COM4B1 5
+#define COM4B0 4
+#define COM4C1 3
+#define COM4C0 2
+#define WGM41 1
+#define WGM40 0
+#define ICNC4 7
+#define ICES4 6
+#define WGM43 4
+#define WGM42 3
+#define CS42 2
+#define CS41 1
+#define CS40 0
+#define ICIE4 5
+#define OCIE4C 3
+#define OCIE4B 2
+#define OCIE4A 1
+#define TOIE4 0
+#define ICF4 5
+#define OCF4C 3
+#define OCF4B 2
+#define OCF4A 1
+#define TOV4 0
+#define FOC4A 7
+#define FOC4B 6
+#define FOC4C 5
+#define COM5A1 7
+#define COM5A0 6
+#define COM5B1 5
+#define COM5B0 4
+#define COM5C1 3
+#define COM5C0 2
+#define WGM51 1
+#define WGM50 0
+#define ICNC5 7
+#define ICES5 6
+#define WGM53 4
+#define WGM52 3
+#define CS52 2
+#define CS51 1
+#define CS50 0
+#define ICIE5 5
+#define OCIE5C 3
+#define OCIE5B 2
+#define OCIE5A 1
+#define TOIE5 0
+#define ICF5 5
+#define OCF5C 3
+#define OCF5B 2
+#define OCF5A 1
+#define TOV5 0
+#define FOC5A 7
+#define RAMEND 0x21FF
+#define RAMSTART 0x200
+#define E2END 0xFFF
+
+
+
+#endif // MOCK_AVR_IO_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,24 @@
+//==============================================================================
+// Host Mock of <avr/pgmspace.h>.
+//
+// Flash and SRAM share one address space on the host.
+//
+
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef MOCK_AVR_PGMSPACE_H_INCLUDED
+#define MOCK_AVR_PGMSPACE_H_INCLUDED
+
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+
+
+
+#endif // MOCK_AVR_PGMSPACE_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
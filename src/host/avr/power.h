@@ -0,0 +1,20 @@
+//==============================================================================
+// Host Mock of <avr/power.h>.
+//
+
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef MOCK_AVR_POWER_H_INCLUDED
+#define MOCK_AVR_POWER_H_INCLUDED
+
+
+#define power_all_enable()
+
+
+
+#endif // MOCK_AVR_POWER_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
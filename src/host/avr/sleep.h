@@ -0,0 +1,26 @@
+//==============================================================================
+// Host Mock of <avr/sleep.h>.
+//
+// Sleep returns immediately.
+//
+
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef MOCK_AVR_SLEEP_H_INCLUDED
+#define MOCK_AVR_SLEEP_H_INCLUDED
+
+
+#define SLEEP_MODE_IDLE 0
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+
+
+
+#endif // MOCK_AVR_SLEEP_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,27 @@
+//==============================================================================
+// Host Mock of <avr/wdt.h>.
+//
+// A watchdog reset calls the harness, see harness.h.
+//
+
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef MOCK_AVR_WDT_H_INCLUDED
+#define MOCK_AVR_WDT_H_INCLUDED
+
+
+static void mock_watchdog_reset(void) __attribute__ ((noreturn));
+
+#define wdt_enable(timeout) mock_watchdog_reset()
+#define wdt_disable()
+#define wdt_reset()
+#define WDTO_15MS 0
+
+
+
+#endif // MOCK_AVR_WDT_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
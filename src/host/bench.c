@@ -0,0 +1,298 @@
+//==============================================================================
+// Host Benchmarks for the Firmware.
+//
+// Runs the firmware (main.c and all headers) against the mock registers in
+// src/host and reports host operations per second for the command parser
+// and the byte-in to line-out paths. These are relative numbers for
+// comparing changes, not AVR timings.
+//
+//   make bench
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define FIFO_WAIT() mock_service_interrupts()
+#define get_pc() 0
+#define main firmware_main
+static void mock_service_interrupts(void);
+
+#include "../main.c"
+
+#undef main
+#include "harness.h"
+
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+
+static void report(const char* const name, const uint32_t n,
+                   const double seconds, const char* const unit)
+{
+    printf("%-28s %12.0f %s/s\n", name, n / seconds, unit);
+}
+
+
+static void expect(const char* const response, const char* const prefix)
+{
+    if (strncmp(response, prefix, strlen(prefix)) != 0) {
+        fprintf(stderr, "Expected \"%s...\", got \"%s\"\n", prefix, response);
+        exit(1);
+    }
+}
+
+
+// process_command() alone, response drained through the UDRE ISR.
+static void bench_process_command(const char* const command,
+                                  const uint32_t n)
+{
+    const uint8_t l = (uint8_t)strlen(command);
+    const double t0 = now();
+    for (uint32_t i = 0 ; i < n ; i++) {
+        process_command((const uint8_t*)command, l);
+        mock_service_interrupts();
+    }
+    const double t = now() - t0;
+    expect(g_mock_line, ">");
+
+    char name[40];
+    snprintf(name, sizeof(name), "command %s", command);
+    report(name, n, t, "cmd");
+}
+
+
+static void bench_parse_hex(const uint32_t n)
+{
+    volatile uint32_t sink = 0;
+    const double t0 = now();
+    for (uint32_t i = 0 ; i < n ; i++) {
+        sink += parse_hex((const uint8_t*)"1A2B3C4D", 8);
+    }
+    report("parse_hex 8 digits", n, now() - t0, "op");
+}
+
+
+// Commands through the RX ISR, linebuf, scheduler and TX ISR.
+static void bench_command_stream(const uint32_t n)
+{
+    static const char stream[] = "IB5\rHB5\rLB5\rIB5\rDB5\r"
+                                 "IB5\rHB5\rLB5\rIB5\rDB5\r";
+    const uint32_t bytes0 = g_mock_tx_bytes[0];
+    const uint32_t lines0 = g_mock_tx_lines;
+    const double t0 = now();
+    for (uint32_t i = 0 ; i < n ; i++) {
+        mock_rx(0, stream, sizeof(stream) - 1U);
+        mock_run();
+    }
+    const double t = now() - t0;
+    expect(g_mock_line, ">DB5");
+    report("command stream", g_mock_tx_lines - lines0, t, "cmd");
+    report("command stream TX", g_mock_tx_bytes[0] - bytes0, t, "byte");
+}
+
+
+// Pin monitor events: toggle Port A, advance past the poll interval.
+static void bench_pin_events(const uint32_t n)
+{
+    for (uint8_t pin = 0 ; pin < 8 ; pin++) {
+        char command[] = "MA0";
+        command[2] = (char)('0' + pin);
+        expect(mock_command(command), ">MA");
+    }
+    const uint32_t lines0 = g_mock_tx_lines;
+    const double t0 = now();
+    for (uint32_t i = 0 ; i < n ; i++) {
+        PINA = (uint8_t)~PINA;
+        mock_tick(21);
+        mock_run();
+    }
+    const double t = now() - t0;
+    expect(g_mock_line, "!");
+    report("pin monitor events", g_mock_tx_lines - lines0, t, "event");
+}
+
+
+// USART1 lines forwarded to USART0.
+static void bench_usart_forward(const uint32_t n)
+{
+    static const char line[] = "The quick brown fox\r\n";
+    const uint32_t lines0 = g_mock_tx_lines;
+    const double t0 = now();
+    for (uint32_t i = 0 ; i < n ; i++) {
+        mock_rx(1, line, sizeof(line) - 1U);
+        mock_run();
+    }
+    const double t = now() - t0;
+    expect(g_mock_line, "1The quick");
+    report("USART1 forward", g_mock_tx_lines - lines0, t, "line");
+}
+
+
+// USART1 bytes routed to USART3, without and with the tap.
+static void bench_usart_route(const char tap, const uint32_t n)
+{
+    static const char line[] = "The quick brown fox\r\n";
+    char command[] = "OS13N";
+    command[4] = tap;
+    expect(mock_command(command), ">OS13");
+
+    const uint32_t bytes0 = g_mock_tx_bytes[3];
+    const double t0 = now();
+    for (uint32_t i = 0 ; i < n ; i++) {
+        mock_rx(1, line, sizeof(line) - 1U);
+        mock_run();
+    }
+    const double t = now() - t0;
+    expect(mock_command("OC"), ">OC");
+    report(tap == 'T' ? "USART1 route, tapped" : "USART1 route",
+           g_mock_tx_bytes[3] - bytes0, t, "byte");
+}
+
+
+// The USART driver instances: RX ISR to RX FIFO, and TX FIFO through
+// the UDRE ISR, checking every byte.
+typedef struct {
+    fifo_t** rx_fifo;
+    void (*tx)(uint8_t c);
+} bench_usart_t;
+
+static const bench_usart_t g_bench_usarts[4] = {
+    {&p_g_usart0_rx_fifo, usart0_tx},
+    {&p_g_usart1_rx_fifo, usart1_tx},
+    {&p_g_usart2_rx_fifo, usart2_tx},
+    {&p_g_usart3_rx_fifo, usart3_tx},
+};
+
+static void bench_usart_driver(const uint8_t n, const uint32_t count)
+{
+    static const char block[] = "0123456789ABCD\r\n";
+    const bench_usart_t* const u = &g_bench_usarts[n];
+    const uint32_t bytes0 = g_mock_tx_bytes[n];
+    const double t0 = now();
+    for (uint32_t i = 0 ; i < count ; i++) {
+        mock_rx(n, block, sizeof(block) - 1U);
+        for (uint8_t k = 0 ; k < sizeof(block) - 1U ; k++) {
+            const uint8_t c = fifo_read(*u->rx_fifo);
+            if (c != (uint8_t)block[k]) {
+                fprintf(stderr, "USART%d RX: expected %c, got %c\n",
+                        n, block[k], c);
+                exit(1);
+            }
+            u->tx(c);
+        }
+        mock_service_interrupts();
+    }
+    const double t = now() - t0;
+    if (g_mock_tx_bytes[n] - bytes0 != count * (sizeof(block) - 1U)
+    ||  fifo_is_not_empty(*u->rx_fifo)) {
+        fprintf(stderr, "USART%d: bytes lost\n", n);
+        exit(1);
+    }
+
+    char name[40];
+    snprintf(name, sizeof(name), "USART%d driver", n);
+    report(name, g_mock_tx_bytes[n] - bytes0, t, "byte");
+}
+
+
+// 64-byte SPI transfers, polled (clk/2) and interrupt driven (clk/128).
+static void bench_spi_transfer(const char clock, const uint32_t n)
+{
+    char config[] = "XC00MB0";
+    config[3] = clock;
+    expect(mock_command(config), ">XC");
+
+    char command[2 + 2 * SPI_BUFFER_SIZE + 1] = "XT";
+    for (uint8_t i = 0 ; i < SPI_BUFFER_SIZE ; i++) {
+        snprintf(command + 2 + 2 * i, 3, "%02X", i);
+    }
+    const double t0 = now();
+    for (uint32_t i = 0 ; i < n ; i++) {
+        mock_command(command);
+    }
+    const double t = now() - t0;
+    expect(g_mock_line + 1, command);
+
+    char name[40];
+    snprintf(name, sizeof(name), "SPI transfer clk/%d", 2 << (clock - '0'));
+    report(name, n * SPI_BUFFER_SIZE, t, "byte");
+}
+
+
+// Bus scan of the (empty) mock TWI bus.
+static void bench_twi_scan(const uint32_t n)
+{
+    expect(mock_command("YC0190"), ">YC0190");
+    const double t0 = now();
+    for (uint32_t i = 0 ; i < n ; i++) {
+        mock_command("YS");
+    }
+    const double t = now() - t0;
+    expect(g_mock_line, ">YS0000000000000000000000000000000000");
+    report("TWI scan", n, t, "scan");
+}
+
+
+// Both stepper axes at 40 kHz, through the Timer 4 compare ISRs.
+static void bench_stepper(const uint16_t ms)
+{
+    expect(mock_command("KC0B0"), ">KC0B0");
+    expect(mock_command("KC1B1"), ">KC1B1");
+    expect(mock_command("KM0000FFFFF9C400F4240"), ">KM0");
+    expect(mock_command("KM1000FFFFF9C400F4240"), ">KM1");
+
+    const int32_t p0 = g_stepper[0].position;
+    const int32_t p1 = g_stepper[1].position;
+    const double t0 = now();
+    mock_tick(ms);
+    const double t = now() - t0;
+    const uint32_t steps = (uint32_t)(g_stepper[0].position - p0)
+                         + (uint32_t)(g_stepper[1].position - p1);
+    expect(mock_command("KX"), "!K1");
+    if (steps < ms * 2U * 39U) {
+        fprintf(stderr, "Stepper: %u steps in %u ms\n", steps, ms);
+        exit(1);
+    }
+    report("stepper 2 axes", steps, t, "step");
+}
+
+
+int main(void)
+{
+    mock_init();
+
+    bench_parse_hex(10000000);
+    bench_process_command("IB5", 1000000);
+    bench_process_command("HB5", 1000000);
+    bench_process_command("AF0", 1000000);
+    bench_process_command("P", 100000);
+    bench_command_stream(100000);
+    bench_pin_events(100000);
+    bench_usart_forward(100000);
+    bench_usart_route('N', 100000);
+    bench_usart_route('T', 100000);
+    for (uint8_t n = 0 ; n < 4 ; n++) {
+        bench_usart_driver(n, 100000);
+    }
+    bench_spi_transfer('0', 100000);
+    bench_spi_transfer('6', 100000);
+    bench_twi_scan(100000);
+    bench_stepper(10000);
+
+    return 0;
+}
+
+
+
+//==============================================================================
+// End of file.
+//==============================================================================
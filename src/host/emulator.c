@@ -0,0 +1,196 @@
+//==============================================================================
+// Pseudo-terminal Emulator of the Board.
+//
+// Runs the host build of the firmware behind a pty so that the Julia
+// driver can be used without hardware:
+//
+//   host_emulator [-l /tmp/mega] [-e <ms>]
+//
+// Prints the slave device name (and links it to -l <path>). USART0 is the
+// pty. USART1-3 TX are looped back to their RX. Output pins read back
+// their level. With -e, the Port A input pins count up every <ms>
+// milliseconds so that monitored pins produce events. The millisecond
+// clock follows the host's clock.
+//
+// A firmware reset ("Z" or an assert) re-executes the emulator on the same
+// pty, so all firmware state starts from scratch as it would on the board.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FIFO_WAIT() mock_service_interrupts()
+#define MOCK_RESET() emulator_reset()
+#define get_pc() 0
+#define main firmware_main
+static void mock_service_interrupts(void);
+static void emulator_reset(void) __attribute__ ((noreturn));
+
+#include "../main.c"
+
+#undef main
+#include "harness.h"
+
+
+static int g_pty = -1;
+static char** g_argv;
+
+static uint8_t g_out[4096];
+static size_t g_out_l = 0;
+
+
+static void emulator_flush(void)
+{
+    size_t i = 0;
+    while (i < g_out_l) {
+        const ssize_t n = write(g_pty, g_out + i, g_out_l - i);
+        if (n <= 0) {
+            break;
+        }
+        i += (size_t)n;
+    }
+    g_out_l = 0;
+}
+
+
+static void emulator_tx(const uint8_t n, const uint8_t c)
+{
+    if (n != 0) {
+        mock_rx(n, (const char*)&c, 1);         // Loopback.
+        return;
+    }
+    if (g_out_l == sizeof(g_out)) {
+        emulator_flush();
+    }
+    g_out[g_out_l++] = c;
+}
+
+
+static void emulator_reset(void)
+{
+    emulator_flush();
+    char fd[16];
+    snprintf(fd, sizeof(fd), "%d", g_pty);
+    setenv("HOST_EMULATOR_FD", fd, 1);
+    execv("/proc/self/exe", g_argv);
+    perror("execv");
+    exit(1);
+}
+
+
+static uint64_t ms_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000U + (uint64_t)t.tv_nsec / 1000000U;
+}
+
+
+static int emulator_open(const char* const link)
+{
+    const int pty = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty < 0 || grantpt(pty) != 0 || unlockpt(pty) != 0) {
+        perror("posix_openpt");
+        exit(1);
+    }
+    const char* const name = ptsname(pty);
+
+    // Hold the slave open so reads don't fail while no client is attached,
+    // raw so that output isn't echoed back as input.
+    const int slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios t;
+    if (slave < 0 || tcgetattr(slave, &t) != 0) {
+        perror(name);
+        exit(1);
+    }
+    cfmakeraw(&t);
+    tcsetattr(slave, TCSANOW, &t);
+    if (link) {
+        unlink(link);
+        if (symlink(name, link) != 0) {
+            perror(link);
+            exit(1);
+        }
+    }
+    printf("%s\n", name);
+    fflush(stdout);
+    return pty;
+}
+
+
+int main(int argc, char* argv[])
+{
+    g_argv = argv;
+    const char* link = NULL;
+    uint32_t event_ms = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "l:e:")) != -1) {
+        switch(opt) {
+            case 'l': link = optarg; break;
+            case 'e': event_ms = (uint32_t)atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-l link] [-e ms]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    const char* const fd = getenv("HOST_EMULATOR_FD");
+    g_pty = fd ? atoi(fd) : emulator_open(link);
+
+    g_mock_tx_hook = emulator_tx;
+    mock_init();
+
+    print_end_of_line();
+    print_c('>');
+    print_c('Z');
+    print_end_of_line();
+    mock_run();
+    emulator_flush();
+
+    uint64_t clock = ms_now();
+    uint64_t next_event = clock + event_ms;
+    uint8_t count = 0;
+
+    for (;;) {
+        struct pollfd p = {.fd = g_pty, .events = POLLIN};
+        if (poll(&p, 1, 1) > 0 && (p.revents & POLLIN)) {
+            char buf[256];
+            const ssize_t n = read(g_pty, buf, sizeof(buf));
+            for (ssize_t i = 0 ; i < n ; i++) {
+                mock_rx(0, buf + i, 1);
+                mock_run();
+            }
+        }
+
+        const uint64_t now = ms_now();
+        while (clock < now) {
+            clock++;
+            mock_tick(1);
+            if (event_ms != 0 && clock >= next_event) {
+                count++;
+                PINA = (uint8_t)((PINA & DDRA) | (count & ~DDRA));
+                next_event += event_ms;
+            }
+            mock_run();
+        }
+        mock_run();
+        emulator_flush();
+    }
+}
+
+
+
+//==============================================================================
+// End of file.
+//==============================================================================
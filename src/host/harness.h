@@ -0,0 +1,331 @@
+//==============================================================================
+// Host Harness for the Firmware.
+//
+// Include after main.c, with src/host on the include path ahead of the
+// AVR headers. Drives the firmware the way the hardware would: received
+// bytes enter through the USART RX ISRs, the millisecond clock advances
+// through the Timer2 ISR, and transmitted bytes leave through the UDRE
+// ISRs. Nothing runs unless the harness calls it.
+//
+// The including file must define, before main.c:
+//
+//   #define FIFO_WAIT() mock_service_interrupts()
+//   #define get_pc() 0
+//   #define main firmware_main
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef HARNESS_H_INCLUDED
+#define HARNESS_H_INCLUDED
+
+#include <stdio.h>
+#include <string.h>
+
+
+// Called for each byte sent on USART `n`.
+static void (*g_mock_tx_hook)(uint8_t n, uint8_t c) = NULL;
+
+// Bytes sent per USART, and the last complete line sent on USART0.
+static uint32_t g_mock_tx_bytes[4];
+static uint32_t g_mock_tx_lines;
+static char g_mock_line[512];
+static char g_mock_tx_line[512];
+static uint16_t g_mock_tx_l;
+
+
+static void mock_tx(const uint8_t n, const uint8_t c)
+{
+    g_mock_tx_bytes[n]++;
+    if (g_mock_tx_hook) {
+        g_mock_tx_hook(n, c);
+    }
+    if (n != 0 || c == '\n') {
+        return;
+    }
+    if (c == '\r') {
+        g_mock_tx_line[g_mock_tx_l] = '\0';
+        memcpy(g_mock_line, g_mock_tx_line, (size_t)g_mock_tx_l + 1U);
+        g_mock_tx_l = 0;
+        g_mock_tx_lines++;
+        return;
+    }
+    if (g_mock_tx_l < sizeof(g_mock_tx_line) - 1U) {
+        g_mock_tx_line[g_mock_tx_l++] = (char)c;
+    }
+}
+
+
+static volatile uint16_t* mock_udr(const uint8_t n)
+{
+    switch(n) {
+        case 0: return &UDR0;
+        case 1: return &UDR1;
+        case 2: return &UDR2;
+        default: return &UDR3;
+    }
+}
+
+
+// Send the byte last written to UDRn, if any.
+static void mock_udr_flush(const uint8_t n)
+{
+    volatile uint16_t* const udr = mock_udr(n);
+    if (*udr != MOCK_UDR_EMPTY) {
+        const uint8_t c = (uint8_t)*udr;
+        *udr = MOCK_UDR_EMPTY;
+        mock_tx(n, c);
+    }
+}
+
+
+// Run the UDRE ISRs until each TX FIFO is empty, and the SPI STC ISR
+// until the transfer is done. The TWI bus is empty: each START completes
+// and each address is NACKed.
+static void mock_service_interrupts(void)
+{
+    while (SPCR & bit1(SPIE)) {
+        SPI_STC_vect();
+    }
+    while ((TWCR & bit2(TWINT, TWIE)) == bit2(TWINT, TWIE)) {
+        TWSR = (TWCR & bit1(TWSTA)) ? 0x08 : (TWDR & 1U) ? 0x48 : 0x20;
+        TWI_vect();
+    }
+    for (uint8_t n = 0 ; n < 4 ; n++) {
+        mock_udr_flush(n);
+    }
+    while (UCSR0B & bit1(UDRIE0)) {
+        USART0_UDRE_vect();
+        mock_udr_flush(0);
+    }
+    while (UCSR1B & bit1(UDRIE1)) {
+        USART1_UDRE_vect();
+        mock_udr_flush(1);
+    }
+    while (UCSR2B & bit1(UDRIE2)) {
+        USART2_UDRE_vect();
+        mock_udr_flush(2);
+    }
+    while (UCSR3B & bit1(UDRIE3)) {
+        USART3_UDRE_vect();
+        mock_udr_flush(3);
+    }
+}
+
+
+// Watchdog reset, by default the harness exits.
+#ifndef MOCK_RESET
+#define MOCK_RESET() exit(1)
+#endif
+
+static void mock_watchdog_reset(void)
+{
+    mock_service_interrupts();
+    fprintf(stderr, "Firmware reset: %s\n", g_mock_line);
+    MOCK_RESET();
+    exit(1);
+}
+
+
+// Receive bytes on USART `n` (0-3).
+static void mock_rx(const uint8_t n, const char* p, size_t l)
+{
+    while (l--) {
+        mock_udr_flush(n);
+        *mock_udr(n) = (uint8_t)*p++;
+        switch(n) {
+            case 0: USART0_RX_vect(); break;
+            case 1: USART1_RX_vect(); break;
+            case 2: USART2_RX_vect(); break;
+            case 3: USART3_RX_vect(); break;
+        }
+        *mock_udr(n) = MOCK_UDR_EMPTY;
+    }
+}
+
+
+// Run Timer/Counter 4 (stepper, clk/8) for `ticks` counts, with its
+// compare ISRs on their matches.
+static void mock_timer4(uint16_t ticks)
+{
+    while (TCCR4B != 0 && ticks--) {
+        TCNT4++;
+        if ((TIMSK4 & bit1(OCIE4A)) && TCNT4 == OCR4A) {
+            TIMER4_COMPA_vect();
+        }
+        if ((TIMSK4 & bit1(OCIE4B)) && TCNT4 == OCR4B) {
+            TIMER4_COMPB_vect();
+        }
+        if ((TIMSK4 & bit1(OCIE4C)) && TCNT4 == OCR4C) {
+            TIMER4_COMPC_vect();
+        }
+    }
+}
+
+
+// Advance the millisecond clock.
+static void mock_tick(uint16_t ms)
+{
+    while (ms--) {
+        mock_timer4(2000);
+        TIMER2_COMPA_vect();
+    }
+}
+
+
+// Drive input `pin` (0-7) of `port` ('A'-'L') to `level`, raising the pin
+// change (PCINT0-23) or external (INT0-7) interrupt that is enabled for it.
+static void mock_input(const uint8_t port, const uint8_t pin,
+                       const bool level)
+{
+    static void (* const int_vect[8])(void) = {
+        INT0_vect, INT1_vect, INT2_vect, INT3_vect,
+        INT4_vect, INT5_vect, INT6_vect, INT7_vect,
+    };
+    volatile uint8_t* const p = gpio_pin_register(port);
+    const uint8_t old = *p;
+    *p = level ? (uint8_t)(old | bit1(pin)) : (uint8_t)(old & ~bit1(pin));
+    if (*p == old) {
+        return;
+    }
+
+    const bool pcint1 = (PCICR & bit1(PCIE1)) != 0;
+    switch(port) {
+        case 'B': if ((PCICR & bit1(PCIE0)) && (PCMSK0 & bit1(pin))) {
+                      PCINT0_vect();
+                  }
+                  break;
+        case 'J': if (pcint1 && pin < 7 && (PCMSK1 & bit1(pin + 1U))) {
+                      PCINT1_vect();
+                  }
+                  break;
+        case 'E': if (pcint1 && pin == 0 && (PCMSK1 & bit1(0))) {
+                      PCINT1_vect();
+                  }
+                  if (pin >= 4 && (EIMSK & bit1(pin))) {
+                      int_vect[pin]();
+                  }
+                  break;
+        case 'D': if (pin < 4 && (EIMSK & bit1(pin))) {
+                      int_vect[pin]();
+                  }
+                  break;
+        case 'K': if ((PCICR & bit1(PCIE2)) && (PCMSK2 & bit1(pin))) {
+                      PCINT2_vect();
+                  }
+                  break;
+    }
+}
+
+
+// Output pins read back their driven level.
+static void mock_pins(void)
+{
+    PINA = (uint8_t)((PINA & ~DDRA) | (PORTA & DDRA));
+    PINB = (uint8_t)((PINB & ~DDRB) | (PORTB & DDRB));
+    PINC = (uint8_t)((PINC & ~DDRC) | (PORTC & DDRC));
+    PIND = (uint8_t)((PIND & ~DDRD) | (PORTD & DDRD));
+    PINE = (uint8_t)((PINE & ~DDRE) | (PORTE & DDRE));
+    PINF = (uint8_t)((PINF & ~DDRF) | (PORTF & DDRF));
+    PING = (uint8_t)((PING & ~DDRG) | (PORTG & DDRG));
+    PINH = (uint8_t)((PINH & ~DDRH) | (PORTH & DDRH));
+    PINJ = (uint8_t)((PINJ & ~DDRJ) | (PORTJ & DDRJ));
+    PINK = (uint8_t)((PINK & ~DDRK) | (PORTK & DDRK));
+    PINL = (uint8_t)((PINL & ~DDRL) | (PORTL & DDRL));
+}
+
+
+// Bytes sent plus bytes taken from the RX FIFOs, changes when a task does
+// any work.
+static uint32_t mock_progress(void)
+{
+    return g_mock_tx_bytes[0] + g_mock_tx_bytes[1]
+         + g_mock_tx_bytes[2] + g_mock_tx_bytes[3]
+         + p_g_usart0_rx_fifo->out + p_g_usart1_rx_fifo->out
+         + p_g_usart2_rx_fifo->out + p_g_usart3_rx_fifo->out;
+}
+
+
+// Scheduler passes that did no work but left tasks ready. On the target
+// such a task keeps the CPU awake.
+static uint32_t g_mock_spins;
+
+
+// Run the scheduler until no task is ready, or until a pass does no work.
+static void mock_run(void)
+{
+    mock_pins();
+    mock_service_interrupts();
+    while (g_scheduler_ready != 0) {
+        const uint32_t progress = mock_progress();
+        scheduler_run(g_tasks, TASK_COUNT);
+        mock_service_interrupts();
+        if (mock_progress() == progress) {
+            if (g_scheduler_ready != 0) {
+                g_mock_spins++;
+            }
+            break;
+        }
+    }
+}
+
+
+// Send a command, return the response line.
+static const char* mock_command(const char* const command)
+{
+    mock_rx(0, command, strlen(command));
+    mock_rx(0, "\r", 1);
+    mock_run();
+    return g_mock_line;
+}
+
+
+// Equivalent of main() up to the scheduler loop.
+static void mock_init(void)
+{
+    UCSR0A = bit1(UDRE0);
+    UCSR1A = bit1(UDRE1);
+    UCSR2A = bit1(UDRE2);
+    UCSR3A = bit1(UDRE3);
+
+    recorder_init();
+    fifo_arena_init();
+    usart0_init();
+    usart1_init();
+    usart2_init();
+    usart3_init();
+    timer2_init();
+    sei();
+
+    for (uint8_t task = 0 ; task < TASK_COUNT ; task++) {
+        scheduler_ready(task);
+    }
+    mock_run();
+}
+
+
+// Boot again after MOCK_RESET() has returned control to the test, e.g.
+// with longjmp(). Host RAM is not cleared the way the C runtime clears it
+// on the board, so only the line that caused the reset, the ready flags
+// and the recorder's current line are dropped here; .noinit state (the
+// flight recorder) is kept, as on the board.
+static void mock_restart(void)
+{
+    linebuf_reset(usart0_linebuf);
+    linebuf_reset(usart1_linebuf);
+    linebuf_reset(usart2_linebuf);
+    linebuf_reset(usart3_linebuf);
+    g_scheduler_ready = 0;
+    g_recorder_event.kind = 0;
+    g_recorder_line_start = true;
+    MCUSR = bit1(WDRF);
+    mock_init();
+}
+
+
+
+#endif // HARNESS_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
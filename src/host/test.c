@@ -0,0 +1,669 @@
+//==============================================================================
+// Host Regression Tests for the Firmware.
+//
+// Runs the firmware (main.c and all headers) against the mock registers in
+// src/host, sends commands through the USART0 RX ISR and checks the exact
+// response lines, the ERROR lines and watchdog resets of the error paths,
+// and that the scheduler goes idle after each command. Exits with status 1
+// if any check fails.
+//
+//   make test
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static jmp_buf g_reset;
+
+#define FIFO_WAIT() mock_service_interrupts()
+#define MOCK_RESET() longjmp(g_reset, 1)
+#define get_pc() 0
+#define main firmware_main
+static void mock_service_interrupts(void);
+
+#include "../main.c"
+
+#undef main
+#include "harness.h"
+
+
+static uint32_t g_checks;
+static uint32_t g_failures;
+
+
+static void check(const bool ok, const char* const name,
+                  const char* const detail)
+{
+    g_checks++;
+    if (!ok) {
+        g_failures++;
+        fprintf(stderr, "FAIL %s: %s\n", name, detail);
+    }
+}
+
+
+// The scheduler must be idle after each command (no task left spinning).
+static void check_idle(const char* const name)
+{
+    check(g_scheduler_ready == 0 && g_mock_spins == 0, name,
+          "scheduler not idle");
+    g_mock_spins = 0;
+}
+
+
+// Send `command`, check that the last response line is `response`.
+static void expect_response(const char* const command,
+                            const char* const response)
+{
+    char detail[600];
+    const char* const line = mock_command(command);
+    snprintf(detail, sizeof(detail), "expected \"%s\", got \"%s\"",
+             response, line);
+    check(strcmp(line, response) == 0, command, detail);
+    check_idle(command);
+}
+
+
+// Send `command`, check that it fails with "ERROR <code> <message>" and a
+// watchdog reset, then boot again.
+static void expect_error(const char* const command,
+                         const char* const message)
+{
+    char detail[600];
+    if (setjmp(g_reset) == 0) {
+        const char* const line = mock_command(command);
+        snprintf(detail, sizeof(detail), "no reset, got \"%s\"", line);
+        check(false, command, detail);
+        return;
+    }
+    const char* const text = g_mock_line + strlen("ERROR xxxx ");
+    snprintf(detail, sizeof(detail), "expected \"ERROR xxxx %s\", got \"%s\"",
+             message, g_mock_line);
+    check(strncmp(g_mock_line, "ERROR ", 6) == 0
+          && strlen(g_mock_line) >= strlen("ERROR xxxx ")
+          && strcmp(text, message) == 0, command, detail);
+    mock_restart();
+}
+
+
+/* Command parsing */
+
+static const char* const g_responses[][2] = {
+    {"HB5",                 ">HB5"},
+    {"IB5",                 ">IB50020"},
+    {"LB5",                 ">LB5"},
+    {"IB5",                 ">IB50000"},
+    {"UA0",                 ">UA0"},
+    {"DA0",                 ">DA0"},
+    {"MA0",                 ">MA0"},
+    {"NA0",                 ">NA0"},
+    {"AF0",                 ">AF00000"},
+    {"1hello",              ">1hello"},
+    {"RS0A0H000000B0101",   ">RS0A0H000000B0101"},
+    {"RX0",                 ">RX0"},
+    {"RC",                  ">RC"},
+    {"EE0012",              ">EE0012"},
+    {"ER0",                 ">ER000000000000000000000"},
+    {"EX0",                 ">EX0"},
+    {"FC",                  ">FC00"},
+    {"YC0190",              ">YC0190"},
+    {"YS",                  ">YS0000000000000000000000000000000000"},
+    {"YT500112",            ">YT50011201"},
+    {"YX",                  ">YX"},
+    {"GF",                  ">GFFFFF202020202020030002BE"},
+};
+
+
+static void test_responses(void)
+{
+    for (size_t i = 0 ; i < sizeof(g_responses) / sizeof(g_responses[0]) ;
+         i++) {
+        expect_response(g_responses[i][0], g_responses[i][1]);
+    }
+}
+
+
+/* Error paths */
+
+static const char* const g_errors[][2] = {
+    {"H",                   "Short Command!"},
+    {"HB9",                 "Bad GPIO Pin!"},
+    {"1",                   "Short Serial Message!"},
+    {"R",                   "Short Reflex Command!"},
+    {"RS0A0H00",            "Bad Reflex Rule!"},
+    {"RS9A0H000000B0101",   "Bad Reflex Rule Number!"},
+    {"RS0A8H000000B0101",   "Bad GPIO Pin!"},
+    {"RS0A0Q000000B0101",   "Bad Reflex Edge!"},
+    {"RQ",                  "Bad Reflex Command!"},
+    {"EE9012",              "Bad Encoder Channel!"},
+    {"ER1",                 "Encoder Not Enabled!"},
+    {"FQ",                  "Bad Recorder Command!"},
+};
+
+
+static void test_errors(void)
+{
+    for (size_t i = 0 ; i < sizeof(g_errors) / sizeof(g_errors[0]) ; i++) {
+        expect_error(g_errors[i][0], g_errors[i][1]);
+    }
+
+    // A line longer than the USART0 line buffer.
+    char line[300];
+    memset(line, 'H', sizeof(line) - 1U);
+    line[sizeof(line) - 1U] = '\0';
+    expect_error(line, "Linebuf Overrun!");
+
+    // Commands still work after each reset.
+    expect_response("IB5", ">IB50000");
+}
+
+
+/* Reflex rules */
+
+// A rule must not keep the scheduler busy, and must act on its input.
+static void test_reflex(void)
+{
+    expect_response("IA0", ">IA00000");
+    expect_response("LB0", ">LB0");
+    expect_response("RS0A0H000000B0101", ">RS0A0H000000B0101");
+    mock_tick(5);
+    mock_run();
+    check_idle("reflex idle");
+    check((PORTB & 1U) == 0, "reflex idle", "output set with no input");
+
+    PINA |= 1U;
+    mock_tick(1);
+    mock_run();
+    check_idle("reflex trigger");
+    check((PORTB & 1U) != 0, "reflex trigger", "output not set");
+    check(strcmp(g_mock_line, "!R00H") == 0, "reflex trigger", g_mock_line);
+
+    PINA &= (uint8_t)~1U;
+    expect_response("RC", ">RC");
+
+    // Interrupt pins act in the ISR, before any tick; the tick reports.
+    static const char* const rules[][3] = {
+        {"DB0", "RS1B0H000000A0202", "!R01H"},      // PCINT0
+        {"DJ6", "RS2J6H000000A0202", "!R02H"},      // PCINT15
+        {"DE0", "RS3E0H000000A0202", "!R03H"},      // PCINT8
+        {"DD1", "RS4D1H000000A0202", "!R04H"},      // INT1
+        {"DE7", "RS5E7H000000A0202", "!R05H"},      // INT7
+    };
+    for (uint8_t i = 0 ; i < sizeof(rules) / sizeof(rules[0]) ; i++) {
+        const char* const rule = rules[i][1];
+        char response[24];
+        expect_response("LA1", ">LA1");
+        snprintf(response, sizeof(response), ">%s", rules[i][0]);
+        expect_response(rules[i][0], response);
+        mock_input((uint8_t)rule[3], (uint8_t)(rule[4] - '0'), false);
+        snprintf(response, sizeof(response), ">%s", rule);
+        expect_response(rule, response);
+        mock_input((uint8_t)rule[3], (uint8_t)(rule[4] - '0'), true);
+        check((PORTA & 2U) != 0, rule, "output not set by the ISR");
+        mock_tick(1);
+        mock_run();
+        check(strcmp(g_mock_line, rules[i][2]) == 0, rule, g_mock_line);
+        mock_input((uint8_t)rule[3], (uint8_t)(rule[4] - '0'), false);
+        expect_response("RC", ">RC");
+    }
+    check(PCICR == 0 && EIMSK == 0, "reflex interrupts", "left enabled");
+
+    // A delay is timed by the tick after the ISR saw the edge.
+    expect_response("LA1", ">LA1");
+    expect_response("DB1", ">DB1");
+    expect_response("RS6B1H000003A0202", ">RS6B1H000003A0202");
+    mock_input('B', 1, true);
+    mock_tick(2);
+    mock_run();
+    check((PORTA & 2U) == 0, "reflex delay", "output set early");
+    mock_tick(1);
+    mock_run();
+    check((PORTA & 2U) != 0, "reflex delay", "output not set");
+    check(strcmp(g_mock_line, "!R06H") == 0, "reflex delay", g_mock_line);
+    mock_input('B', 1, false);
+    expect_response("RC", ">RC");
+}
+
+
+
+/* Quadrature encoder */
+
+// Step encoder 0 (A = PK0, B = PK1) by `n` counts, one per ms.
+static void encoder_steps(int16_t n)
+{
+    static const uint8_t gray[4] = {0, 1, 3, 2};
+    static uint8_t phase = 0;
+    while (n != 0) {
+        phase = (uint8_t)(phase + (n > 0 ? 1U : 3U)) & 3U;
+        n += n > 0 ? -1 : 1;
+        mock_input('K', 0, gray[phase] & 2U);
+        mock_input('K', 1, gray[phase] & 1U);
+        mock_tick(1);
+        mock_run();
+    }
+}
+
+
+// An index pulse zeros the position but not the velocity, and invalid
+// transitions are counted in "ER".
+static void test_encoder(void)
+{
+    mock_input('K', 0, false);
+    mock_input('K', 1, false);
+    mock_input('K', 2, false);
+    expect_response("EE0012", ">EE0012");
+    encoder_steps(100);
+    expect_response("ER0", ">ER000000064000003E80000");     // 1000/s
+
+    mock_input('K', 2, true);
+    mock_input('K', 2, false);
+    encoder_steps(25);
+    expect_response("ER0", ">ER000000019000003E80000");
+    encoder_steps(25);
+    expect_response("ER0", ">ER000000032000003E80000");
+
+    // A and B change together, twice.
+    PINK ^= 3U;
+    PCINT2_vect();
+    PINK ^= 3U;
+    PCINT2_vect();
+    expect_response("EZ0", ">EZ0");
+    expect_response("ER0", ">ER000000000000003E80002");
+    expect_response("EX0", ">EX0");
+}
+
+
+/* Stepper motion */
+
+// Run until the axis reports its move done. Returns the ms taken, and
+// the highest speed and the speed in the last ms (steps/s).
+static uint16_t stepper_run(const uint8_t axis, const uint16_t max_ms,
+                            uint32_t* const peak, uint32_t* const last)
+{
+    char event[4] = {'!', 'K', (char)('0' + axis), '\0'};
+    *peak = 0;
+    for (uint16_t ms = 1 ; ms <= max_ms ; ms++) {
+        *last = g_stepper[axis].v >> 8U;
+        if (*last > *peak) {
+            *peak = *last;
+        }
+        mock_tick(1);
+        mock_run();
+        if (strncmp(g_mock_line, event, 3) == 0) {
+            return ms;
+        }
+    }
+    return 0;
+}
+
+
+static void test_stepper(void)
+{
+    uint32_t peak;
+    uint32_t last;
+    char detail[80];
+
+    expect_response("KC0B0", ">KC0B0");
+    expect_response("KC1B1", ">KC1B1");
+    expect_response("KP000000000", ">KP000000000");
+    expect_response("KP100000000", ">KP100000000");
+
+    // 4000 steps at 100000 steps/s², a triangle peaking at 20000 steps/s
+    // after 200 ms.
+    expect_response("KM000000FA09C400186A0", ">KM000000FA09C400186A0");
+    const uint16_t ms = stepper_run(0, 1000, &peak, &last);
+    snprintf(detail, sizeof(detail), "%u ms, peak %u, last %u steps/s",
+             ms, peak, last);
+    check(strcmp(g_mock_line, "!K000000FA0") == 0, "stepper move", g_mock_line);
+    check(ms >= 380 && ms <= 420, "stepper move time", detail);
+    check(peak >= 19500 && peak <= 20500, "stepper move peak", detail);
+    check(last * 10U <= peak, "stepper move end speed", detail);
+    check(!g_stepper_enabled, "stepper move", "timer not released");
+
+    // Stop from 10000 steps/s at 10000 steps/s²: 5000 steps.
+    expect_response("KM1000186A02710002710", ">KM1000186A02710002710");
+    mock_tick(2000);
+    mock_run();
+    const int32_t position = g_stepper[1].position;
+    expect_response("KS1", ">KS1");
+    stepper_run(1, 2000, &peak, &last);
+    const int32_t stop = g_stepper[1].done_position - position;
+    snprintf(detail, sizeof(detail), "%d steps, last %u steps/s", stop, last);
+    check(stop >= 4950 && stop <= 5050, "stepper stop distance", detail);
+    check(last <= 1000, "stepper stop end speed", detail);
+
+    expect_response("KQ1", ">KQ10000004EA300");
+}
+
+
+/* ADC telemetry */
+
+// Reader for the 6-bit characters of a "~" line, MSB first.
+typedef struct {
+    const char* p;
+    uint8_t bits;
+    uint8_t nbits;
+} test_bits_t;
+
+static uint32_t get_bits(test_bits_t* const b, uint8_t n)
+{
+    uint32_t value = 0;
+    while (n--) {
+        if (b->nbits == 0) {
+            b->bits = (uint8_t)(*b->p++ - '0');
+            b->nbits = 6;
+        }
+        b->nbits--;
+        value = (value << 1U) | ((b->bits >> b->nbits) & 1U);
+    }
+    return value;
+}
+
+static uint16_t get_varint(test_bits_t* const b)
+{
+    uint16_t value = 0;
+    uint8_t shift = 0;
+    uint32_t group;
+    do {
+        group = get_bits(b, 4);
+        value |= (uint16_t)((group & 7U) << shift);
+        shift += 3U;
+    } while (group & 8U);
+    return value;
+}
+
+
+// ADC values injected through the ADC ISR come back out of a "~" line.
+static void test_telemetry(void)
+{
+    static const uint16_t values[4][2] = {
+        {100, 500}, {200, 503}, {1023, 490}, {0, 1000},
+    };
+
+    expect_response("TS00030001040002", ">TS00030001040002");
+    const uint32_t t0 = ms_clock32();
+    for (uint8_t set = 0 ; set < 4 ; set++) {
+        for (uint8_t i = 0 ; i < 2 ; i++) {
+            ADC = values[set][g_adc_channel];
+            ADC_vect();
+        }
+        mock_tick(1);
+        mock_run();
+    }
+    check(g_mock_line[0] == '~', "telemetry", g_mock_line);
+
+    test_bits_t b = {.p = g_mock_line + 1};
+    check(get_bits(&b, 32) == t0 + 1U, "telemetry time", g_mock_line);
+    check(get_bits(&b, 8) == 4, "telemetry count", g_mock_line);
+    uint16_t previous = 0;
+    bool ok = true;
+    for (uint8_t set = 0 ; set < 4 ; set++) {
+        const uint16_t raw = (uint16_t)get_bits(&b, 10);
+        uint16_t delta;
+        if (set == 0) {
+            delta = (uint16_t)get_bits(&b, 10);
+        } else {
+            const uint16_t z = get_varint(&b);
+            delta = (uint16_t)(previous + ((z >> 1U) ^ (uint16_t)-(z & 1U)));
+        }
+        ok = ok && raw == values[set][0] && delta == values[set][1];
+        previous = delta;
+    }
+    check(ok, "telemetry values", g_mock_line);
+    check(b.p == g_mock_line + strlen(g_mock_line), "telemetry length",
+          g_mock_line);
+
+    expect_response("TX", ">TX");
+}
+
+
+/* USART drivers */
+
+typedef struct {
+    fifo_t** rx_fifo;
+    fifo_t** tx_fifo;
+    void (*tx)(uint8_t c);
+    volatile uint8_t* ucsrb;
+    uint8_t task;                   // Readied by USARTn_RX_NOTIFY.
+} test_usart_t;
+
+static const test_usart_t g_test_usarts[4] = {
+    {&p_g_usart0_rx_fifo, &p_g_usart0_tx_fifo, usart0_tx, &UCSR0B,
+     TASK_COMMAND},
+    {&p_g_usart1_rx_fifo, &p_g_usart1_tx_fifo, usart1_tx, &UCSR1B,
+     TASK_USART1},
+    {&p_g_usart2_rx_fifo, &p_g_usart2_tx_fifo, usart2_tx, &UCSR2B,
+     TASK_USART2},
+    {&p_g_usart3_rx_fifo, &p_g_usart3_tx_fifo, usart3_tx, &UCSR3B,
+     TASK_USART3},
+};
+
+
+static char g_usart_sent[8];
+static uint8_t g_usart_sent_l;
+
+static void capture_usart(const uint8_t n, const uint8_t c)
+{
+    (void)n;
+    if (g_usart_sent_l < sizeof(g_usart_sent) - 1U) {
+        g_usart_sent[g_usart_sent_l++] = (char)c;
+        g_usart_sent[g_usart_sent_l] = '\0';
+    }
+}
+
+
+// Every instance generated by AVR_USART(): RX overrun, RX notify, TX
+// through the UDRE ISR and TX with interrupts disabled.
+static void test_usart(const uint8_t n)
+{
+    const test_usart_t* const u = &g_test_usarts[n];
+    char name[40];
+
+    // USARTn_RX_NOTIFY readies the port's task.
+    snprintf(name, sizeof(name), "USART%d RX notify", n);
+    g_scheduler_ready = 0;
+    mock_rx(n, "x", 1);
+    check(g_scheduler_ready == bit1(u->task), name, "task not ready");
+    g_scheduler_ready = 0;
+    fifo_read(*u->rx_fifo);
+
+    // A full RX FIFO drops its oldest byte.
+    snprintf(name, sizeof(name), "USART%d RX overrun", n);
+    const uint8_t size = (*u->rx_fifo)->size;
+    for (uint16_t i = 0 ; i < size + 2U ; i++) {
+        const char c = (char)i;
+        mock_rx(n, &c, 1);
+    }
+    bool ok = true;
+    for (uint16_t i = 3 ; i < size + 2U ; i++) {
+        ok = ok && fifo_is_not_empty(*u->rx_fifo)
+                && fifo_read(*u->rx_fifo) == (uint8_t)i;
+    }
+    check(ok && fifo_is_empty(*u->rx_fifo), name, "wrong bytes kept");
+    g_scheduler_ready = 0;
+
+    g_mock_tx_hook = capture_usart;
+
+    // TX through the FIFO, UDRIE is off once it has drained.
+    snprintf(name, sizeof(name), "USART%d TX", n);
+    g_usart_sent_l = 0;
+    u->tx('a');
+    u->tx('b');
+    check((*u->ucsrb & bit1(UDRIE0)) != 0, name, "UDRIE not enabled");
+    mock_service_interrupts();
+    check((*u->ucsrb & bit1(UDRIE0)) == 0, name, "UDRIE left enabled");
+    check(fifo_is_empty(*u->tx_fifo), name, "TX FIFO not empty");
+    check(g_usart_sent_l == 2 && strcmp(g_usart_sent, "ab") == 0, name,
+          "wrong bytes sent");
+
+    // With interrupts disabled (error()) bytes go straight to UDRn.
+    snprintf(name, sizeof(name), "USART%d TX, cli", n);
+    g_usart_sent_l = 0;
+    cli();
+    u->tx('c');
+    u->tx('d');
+    sei();
+    check((*u->ucsrb & bit1(UDRIE0)) == 0, name, "UDRIE enabled");
+    check(fifo_is_empty(*u->tx_fifo), name, "TX FIFO not empty");
+    mock_udr_flush(n);
+    check(g_usart_sent_l == 2 && strcmp(g_usart_sent, "cd") == 0, name,
+          "wrong bytes sent");
+
+    g_mock_tx_hook = NULL;
+    g_mock_tx_l = 0;                    // Not a response line.
+}
+
+
+/* Flight recorder */
+
+// USART0 lines captured while a multi-line response is sent.
+static char g_lines[RECORDER_SIZE + 4][80];
+static uint8_t g_lines_n;
+static uint8_t g_lines_l;
+
+
+static void capture_line(const uint8_t n, const uint8_t c)
+{
+    if (n != 0 || c == '\n'
+    ||  g_lines_n == sizeof(g_lines) / sizeof(g_lines[0])) {
+        return;
+    }
+    char* const line = g_lines[g_lines_n];
+    if (c == '\r') {
+        line[g_lines_l] = '\0';
+        g_lines_n++;
+        g_lines_l = 0;
+    } else if (g_lines_l < sizeof(g_lines[0]) - 1U) {
+        line[g_lines_l++] = (char)c;
+    }
+}
+
+
+static void capture_response(const char* const command)
+{
+    g_lines_n = 0;
+    g_lines_l = 0;
+    g_mock_tx_hook = capture_line;
+    mock_command(command);
+    g_mock_tx_hook = NULL;
+}
+
+
+// "FR" after a watchdog reset shows the error and the commands before and
+// after it.
+static void test_recorder(void)
+{
+    static const char* const entries[] = {"CHB5", "CHB9", "CLB5", "CFR"};
+
+    expect_response("FC", ">FC00");
+    expect_response("HB5", ">HB5");
+    expect_error("HB9", "Bad GPIO Pin!");
+    expect_response("LB5", ">LB5");
+    capture_response("FR");
+
+    check(g_lines_n == 6, "FR", "expected 6 lines");
+    check(strncmp(g_lines[0], "#R081", 5) == 0, "FR reset cause", g_lines[0]);
+    check(strcmp(g_lines[0] + strlen("#R0810000xxxxxxxx"), "Bad GPIO Pin!")
+          == 0, "FR error", g_lines[0]);
+    for (uint8_t i = 0 ; i < 4 ; i++) {
+        check(strncmp(g_lines[1 + i], "#E", 2) == 0
+              && strcmp(g_lines[1 + i] + strlen("#Exxxxxxxx"), entries[i])
+              == 0, "FR entry", g_lines[1 + i]);
+    }
+    check(strcmp(g_lines[5], ">FR04") == 0, "FR", g_lines[5]);
+}
+
+
+
+/* Modbus RTU */
+
+static uint8_t g_modbus_reply[MODBUS_FRAME_SIZE];
+static uint8_t g_modbus_reply_l;
+
+static void capture_modbus(const uint8_t n, const uint8_t c)
+{
+    if (n == 0 && g_modbus_reply_l < sizeof(g_modbus_reply)) {
+        g_modbus_reply[g_modbus_reply_l++] = c;
+    }
+}
+
+
+// Send Read Coils 0-7 to slave 1 in two parts `ms` apart, let t3.5 pass,
+// return the length of the reply.
+static uint8_t modbus_request(const uint16_t ms)
+{
+    static const uint8_t request[] = {1, 1, 0, 0, 0, 8};
+    uint8_t frame[sizeof(request) + 2U];
+    uint16_t crc = 0xFFFFU;
+    for (uint8_t i = 0 ; i < sizeof(request) ; i++) {
+        frame[i] = request[i];
+        crc = modbus_crc_update(crc, request[i]);
+    }
+    frame[sizeof(request)] = (uint8_t)crc;
+    frame[sizeof(request) + 1U] = (uint8_t)(crc >> 8U);
+
+    g_modbus_reply_l = 0;
+    g_mock_tx_hook = capture_modbus;
+    mock_rx(0, (const char*)frame, 3);
+    mock_tick(ms);
+    mock_run();
+    mock_rx(0, (const char*)frame + 3, sizeof(frame) - 3U);
+    mock_run();
+    mock_tick(2);
+    mock_run();
+    g_mock_tx_hook = NULL;
+    return g_modbus_reply_l;
+}
+
+
+// Frames are answered after any idle time, including one where the 16-bit
+// us clock has wrapped into the t1.5-t3.5 window, and a t1.5 gap inside a
+// frame drops it. Runs last: Modbus stays on until reset.
+static void test_modbus(void)
+{
+    expect_response("BM01", ">BM01");
+
+    check(modbus_request(0) == 6 && g_modbus_reply[2] == 1, "Modbus",
+          "no reply");
+    mock_tick(65);                      // 67 ms since the last byte,
+                                        // 67000 us wraps to 1464 us.
+    mock_run();
+    check(modbus_request(0) == 6, "Modbus after idle", "no reply");
+    check(modbus_request(1) == 0, "Modbus t1.5 gap", "reply");
+    check(modbus_request(0) == 6, "Modbus after gap", "no reply");
+    check_idle("Modbus");
+
+    g_modbus_address = 0;
+}
+
+
+
+int main(void)
+{
+    mock_init();
+
+    test_responses();
+    test_errors();
+    test_reflex();
+    test_encoder();
+    test_stepper();
+    test_telemetry();
+    for (uint8_t n = 0 ; n < 4 ; n++) {
+        test_usart(n);
+    }
+    test_recorder();
+    test_modbus();
+
+    printf("%u checks, %u failed\n", g_checks, g_failures);
+    return g_failures == 0 ? 0 : 1;
+}
+
+
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,25 @@
+//==============================================================================
+// Host Mock of <util/atomic.h>.
+//
+// ISRs only run when the harness calls them, so blocks are already atomic.
+//
+
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef MOCK_UTIL_ATOMIC_H_INCLUDED
+#define MOCK_UTIL_ATOMIC_H_INCLUDED
+
+
+#define ATOMIC_BLOCK(type) for (uint8_t mock_atomic = 1 ; mock_atomic ; \
+                                mock_atomic = 0)
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 0
+
+
+
+#endif // MOCK_UTIL_ATOMIC_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
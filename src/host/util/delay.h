@@ -0,0 +1,23 @@
+//==============================================================================
+// Host Mock of <util/delay.h>.
+//
+// Delays return immediately.
+//
+
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef MOCK_UTIL_DELAY_H_INCLUDED
+#define MOCK_UTIL_DELAY_H_INCLUDED
+
+
+#define _delay_us(us)
+#define _delay_ms(ms)
+
+
+
+#endif // MOCK_UTIL_DELAY_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -32,11 +32,12 @@ static void linebuf_reset(linebuf_t* linebuf)
 static bool linebuf_is_ready(linebuf_t* linebuf) { return linebuf->ready; }
 
 
-static void linebuf_append(linebuf_t* linebuf, fifo_t* fifo)
+// Read up to `budget` bytes from `fifo`, stop at end of line.
+static void linebuf_append(linebuf_t* linebuf, fifo_t* fifo, uint8_t budget)
 {
     assert(!linebuf_is_ready(linebuf), "Linebuf Not Reset!");
 
-    while (fifo_is_not_empty(fifo)) {
+    while (budget-- != 0 && fifo_is_not_empty(fifo)) {
 
         const uint8_t c = fifo_read(fifo);
 
@@ -0,0 +1,289 @@
+//==============================================================================
+// Logic Analyzer Capture.
+//
+// Samples one port (8 channels) or two ports (16 channels) into an SRAM
+// ring buffer at a fixed rate, with an optional trigger and pre/post
+// trigger depth, then dumps the buffer as hex (optionally run-length
+// encoded) "#" lines.
+//
+// Sampling runs in a tight loop with interrupts disabled, paced by the
+// Timer/Counter 1 compare flag (clk/1 resolution). The millisecond clock
+// and USART interrupts are held off while capturing. A byte arriving on
+// USART0 while waiting for the trigger aborts the capture.
+//
+// The loop's cycle count per sample has not been measured on the target,
+// so it flags an overrun when a sample is due before the previous one has
+// been stored (OCF1A already set), and "WC" reports it.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef LOGIC_H_INCLUDED
+#define LOGIC_H_INCLUDED
+
+
+// Buffer size in bytes, must be a power of two.
+#ifndef LOGIC_BUFFER_SIZE
+#define LOGIC_BUFFER_SIZE 2048U
+#endif
+
+#if (LOGIC_BUFFER_SIZE & (LOGIC_BUFFER_SIZE - 1)) != 0
+#error "LOGIC_BUFFER_SIZE must be a power of two"
+#endif
+
+// Shortest sample period in clk/1 ticks (400 kHz). A capture whose loop
+// is slower than the period it was given reports an overrun.
+#define LOGIC_MIN_TICKS 40U
+
+// 8 channel samples (or runs) per dump line.
+#define LOGIC_LINE_SAMPLES 30U
+
+
+static uint8_t g_logic_buffer[LOGIC_BUFFER_SIZE];
+
+static bool g_logic_wide = false;           // Two ports per sample.
+static uint16_t g_logic_start = 0;          // Index of first sample.
+static uint16_t g_logic_length = 0;         // Samples captured.
+static bool g_logic_overrun = false;        // Sample period was too short.
+
+
+// Wait for the next sample time. Returns non-zero if it had already
+// passed. [DS40002211A, 17.11]
+static inline __attribute__((always_inline)) uint8_t logic_wait(void)
+{
+    const uint8_t late = TIFR1 & bit1(OCF1A);
+    while ((TIFR1 & bit1(OCF1A)) == 0) {}
+    TIFR1 = bit1(OCF1A);
+    return late;
+}
+
+
+static inline __attribute__((always_inline))
+uint16_t logic_sample(volatile uint8_t* const pin_a,
+                      volatile uint8_t* const pin_b, const bool wide)
+{
+    return wide ? (uint16_t)(*pin_a | (*pin_b << 8U)) : *pin_a;
+}
+
+
+static inline __attribute__((always_inline))
+void logic_store(const uint16_t i, const uint16_t sample, const bool wide)
+{
+    if (wide) {
+        const uint16_t j = (uint16_t)(i * 2U) & (LOGIC_BUFFER_SIZE - 1U);
+        g_logic_buffer[j] = sample;
+        g_logic_buffer[j + 1U] = sample >> 8U;
+    } else {
+        g_logic_buffer[i & (LOGIC_BUFFER_SIZE - 1U)] = sample;
+    }
+}
+
+
+// Capture loop, specialised for 8 or 16 channels by inlining.
+// Returns the ring index of the trigger sample, or 0xFFFF if aborted.
+// Sets g_logic_overrun if any sample was late.
+// Trigger modes: 'N' none, 'P' while (sample & mask) == value,
+// 'E' when (sample & mask) becomes equal to value.
+static inline __attribute__((always_inline))
+uint16_t logic_run(volatile uint8_t* const pin_a,
+                   volatile uint8_t* const pin_b, const bool wide,
+                   const uint8_t mode, const uint16_t mask,
+                   const uint16_t value, const uint16_t pre,
+                   const uint16_t post)
+{
+    const uint16_t ring = wide ? LOGIC_BUFFER_SIZE / 2U : LOGIC_BUFFER_SIZE;
+    uint16_t i = 0;
+    uint16_t n = 0;
+    uint8_t late = 0;
+    bool was_match = true;
+
+    // Pre-trigger.
+    for (;;) {
+        late |= logic_wait();
+        const uint16_t sample = logic_sample(pin_a, pin_b, wide);
+        logic_store(i, sample, wide);
+        const bool match = (sample & mask) == value;
+        if (n >= pre) {
+            if (mode == 'N' || (match && (mode == 'P' || !was_match))) {
+                break;
+            }
+        } else {
+            n++;
+        }
+        was_match = match;
+        i = (i + 1U) & (ring - 1U);
+        if (UCSR0A & bit1(RXC0)) {
+            g_logic_overrun = late != 0;
+            return 0xFFFFU;
+        }
+    }
+    const uint16_t trigger = i;
+
+    // Post-trigger.
+    for (uint16_t j = 0 ; j < post ; j++) {
+        i = (i + 1U) & (ring - 1U);
+        late |= logic_wait();
+        logic_store(i, logic_sample(pin_a, pin_b, wide), wide);
+    }
+    g_logic_overrun = late != 0;
+    return trigger;
+}
+
+
+static uint16_t logic_capture(const uint8_t port_a, const uint8_t port_b,
+                              const uint16_t ticks, const uint8_t mode,
+                              const uint16_t mask, const uint16_t value,
+                              const uint16_t pre, const uint16_t post)
+{
+    const bool wide = port_b != '-';
+    const uint16_t ring = wide ? LOGIC_BUFFER_SIZE / 2U : LOGIC_BUFFER_SIZE;
+    assert(ticks >= LOGIC_MIN_TICKS, "Logic Sample Rate Too High!");
+    assert((uint32_t)pre + post + 1U <= ring, "Logic Capture Too Long!");
+    assert(mode == 'N' || mode == 'P' || mode == 'E', "Bad Logic Trigger!");
+
+    volatile uint8_t* const pin_a = gpio_pin_register(port_a);
+    volatile uint8_t* const pin_b = wide ? gpio_pin_register(port_b) : pin_a;
+
+    timer_claim(1, 'L');
+    timer_power_on(1);
+
+    uint16_t trigger;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+
+        // CTC mode, TOP = OCR1A, clk/1, no interrupts.
+        // [DS40002211A, Table 17-2, Table 17-6]
+        TIMSK1 = 0;
+        TCCR1A = 0;
+        TCCR1B = 0;
+        TCNT1 = 0;
+        OCR1A = ticks - 1U;
+        TIFR1 = bit1(OCF1A);
+        TCCR1B = bit2(WGM12, CS10);
+
+        if (wide) {
+            trigger = logic_run(pin_a, pin_b, true,
+                                mode, mask, value, pre, post);
+        } else {
+            trigger = logic_run(pin_a, pin_b, false,
+                                mode, mask, value, pre, post);
+        }
+
+        TCCR1B = 0;
+    }
+    timer_release(1, 'L');
+
+    g_logic_wide = wide;
+    if (trigger == 0xFFFFU) {
+        g_logic_start = 0;
+        g_logic_length = 0;
+    } else {
+        g_logic_start = (trigger - pre) & (ring - 1U);
+        g_logic_length = pre + 1U + post;
+    }
+    return trigger;
+}
+
+
+static uint16_t logic_read(const uint16_t k)
+{
+    if (g_logic_wide) {
+        const uint16_t i = ((g_logic_start + k) * 2U)
+                         & (LOGIC_BUFFER_SIZE - 1U);
+        return g_logic_buffer[i] | (g_logic_buffer[i + 1U] << 8U);
+    }
+    return g_logic_buffer[(g_logic_start + k) & (LOGIC_BUFFER_SIZE - 1U)];
+}
+
+
+static void logic_print_sample(const uint16_t sample)
+{
+    if (g_logic_wide) {
+        print_hex16(sample);
+    } else {
+        print_hex(sample);
+    }
+}
+
+
+// Dump samples as "#" lines of hex samples, or of
+// <count:2><sample> run-length pairs.
+static void logic_dump(const bool rle)
+{
+    uint8_t line = 0;
+    uint16_t k = 0;
+
+    while (k < g_logic_length) {
+        if (line == 0) {
+            print_c('#');
+        }
+        const uint16_t sample = logic_read(k++);
+        if (rle) {
+            uint8_t count = 1;
+            while (k < g_logic_length && count < 0xFFU
+                                      && logic_read(k) == sample) {
+                count++;
+                k++;
+            }
+            print_hex(count);
+        }
+        logic_print_sample(sample);
+        if (++line == LOGIC_LINE_SAMPLES / (g_logic_wide ? 2U : 1U)) {
+            print_end_of_line();
+            line = 0;
+        }
+    }
+    if (line != 0) {
+        print_end_of_line();
+    }
+}
+
+
+
+/* Commands */
+
+// WC<port><port|-><ticks:4><N|P|E><mask:4><value:4><pre:4><post:4>
+//              Capture at F_CPU/<ticks> samples per second.
+//              Responds with samples captured, trigger offset
+//              (0000 if aborted) and <overrun:2>, 01 if the loop could
+//              not keep up with <ticks> (the sample times are wrong).
+// WD<R|H>      Dump "#" lines, run-length (R) or plain hex (H).
+static void logic_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 2, "Short Logic Command!");
+
+    switch(p[1]) {
+        case 'C': assert(l == 25, "Bad Logic Capture!");
+                  logic_capture(p[2], p[3],
+                                (uint16_t)parse_hex(p + 4, 4),
+                                p[8],
+                                (uint16_t)parse_hex(p + 9, 4),
+                                (uint16_t)parse_hex(p + 13, 4),
+                                (uint16_t)parse_hex(p + 17, 4),
+                                (uint16_t)parse_hex(p + 21, 4));
+                  break;
+        case 'D': assert(l == 3, "Bad Logic Dump!");
+                  logic_dump(p[2] == 'R');
+                  break;
+        default: assert(0, "Bad Logic Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    print_hex16(g_logic_length);
+    if (p[1] == 'C') {
+        print_hex16(g_logic_length ? (uint16_t)parse_hex(p + 17, 4) : 0);
+        print_hex(g_logic_overrun ? 1U : 0U);
+    }
+    print_end_of_line();
+}
+
+
+
+#endif // LOGIC_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
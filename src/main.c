@@ -12,25 +12,86 @@
 
 #include <avr/io.h>
 #include <avr/wdt.h>
+#include <avr/eeprom.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <avr/power.h>
+#include <avr/sleep.h>
 #include <util/atomic.h>
 #include <util/delay.h>
 
 #include "assert.h"
 #include "bit.h"
 
+#include "avr_timers.h"
+#include "profile.h"
+#include "scheduler.h"
+
+// Tasks, in run order.
+enum {
+    TASK_COMMAND,
+    TASK_USART1,
+    TASK_USART2,
+    TASK_USART3,
+    TASK_TICK,
+    TASK_COUNT
+};
+
+static void modbus_rx_notify(void);
+#define USART0_RX_NOTIFY() { modbus_rx_notify(); \
+                             scheduler_ready_from_isr(TASK_COMMAND); }
+#define USART1_RX_NOTIFY() scheduler_ready_from_isr(TASK_USART1)
+#define USART2_RX_NOTIFY() scheduler_ready_from_isr(TASK_USART2)
+#define USART3_RX_NOTIFY() scheduler_ready_from_isr(TASK_USART3)
+#define TIMER2_TICK_NOTIFY() scheduler_ready_from_isr(TASK_TICK)
+#define SPI_DONE_NOTIFY() scheduler_ready_from_isr(TASK_COMMAND)
+#define TWI_DONE_NOTIFY() scheduler_ready_from_isr(TASK_COMMAND)
+
 #include "avr_gpio.h"
 #include "fifo.h"
 #define USART0_RX_FIFO_SIZE 255
 #define USART0_TX_FIFO_SIZE 255
+#include "avr_usart.h"
 #include "avr_usart0.h"
 #include "avr_usart1.h"
 #include "avr_usart2.h"
 #include "avr_usart3.h"
 #include "avr_timer2.h"
+// Text output is suppressed in Modbus mode.
+static void text_tx(const uint8_t c);
+#define PRINT_C text_tx
+static void recorder_error(const uint16_t code, const char* const message);
+#define ERROR_NOTIFY(code, message) recorder_error((code), (message))
 #include "print.h"
+#include "parse.h"
 #include "linebuf.h"
+#include "fifo_arena.h"
+#include "avr_capture.h"
+#include "avr_sequence.h"
+#include "stepper.h"
+#include "reflex.h"
+#include "avr_encoder.h"
+#include "logic.h"
+#include "avr_adc.h"
+#include "adc_monitor.h"
+#include "telemetry.h"
+#include "avr_spi.h"
+#include "avr_twi.h"
+#include "usart_jobs.h"
+#include "usart_routes.h"
+#include "modbus.h"
+#include "recorder.h"
+#include "sram.h"
+
+
+static void text_tx(const uint8_t c)
+{
+    recorder_output(c);
+    if (!modbus_is_enabled()) {
+        usart0_tx(c);
+    }
+}
+
 
 typedef struct {
     uint8_t mask;
@@ -89,6 +150,41 @@ static void poll_ports()
 }
 
 
+static void snapshot_port(const uint8_t pin, const uint8_t ddr,
+                          const uint8_t port, const pin_monitor_t* p_pin_monitor)
+{
+    print_hex(pin);
+    print_hex(ddr);
+    print_hex(port);
+    print_hex(p_pin_monitor->mask);
+}
+
+
+// Print timestamp, PIN, DDR, PORT and monitor mask for ports A-L and
+// the value of ADC channels F0-F7, K0-K7 (3 hex digits each).
+static void snapshot(void)
+{
+    print_hex32(ms_clock32());
+    snapshot_port(PINA, DDRA, PORTA, &pin_monitor_a);
+    snapshot_port(PINB, DDRB, PORTB, &pin_monitor_b);
+    snapshot_port(PINC, DDRC, PORTC, &pin_monitor_c);
+    snapshot_port(PIND, DDRD, PORTD, &pin_monitor_d);
+    snapshot_port(PINE, DDRE, PORTE, &pin_monitor_e);
+    snapshot_port(PINF, DDRF, PORTF, &pin_monitor_f);
+    snapshot_port(PING, DDRG, PORTG, &pin_monitor_g);
+    snapshot_port(PINH, DDRH, PORTH, &pin_monitor_h);
+    snapshot_port(PINJ, DDRJ, PORTJ, &pin_monitor_j);
+    snapshot_port(PINK, DDRK, PORTK, &pin_monitor_k);
+    snapshot_port(PINL, DDRL, PORTL, &pin_monitor_l);
+
+    for (uint8_t i = 0 ; i < 16 ; i++) {
+        const uint16_t value = adc_read(i < 8 ? 'F' : 'K', i & 7U);
+        print_hex_digit(value >> 8U);
+        print_hex(value & 0xFFU);
+    }
+}
+
+
 static void monitor_input(const uint8_t port, const uint8_t pin)
 {
     const uint8_t mask = 1U << (pin & 0x0FU);
@@ -129,16 +225,33 @@ static void unmonitor_input(const uint8_t port, const uint8_t pin)
 }
 
 
+// Bytes read from a FIFO per task run.
+#define TASK_RX_BUDGET 16U
+
+
 static void forward_usart_rx(const uint8_t prefix,
-                             fifo_t* rx_fifo, linebuf_t* linebuf)
+                             fifo_t* rx_fifo, linebuf_t* linebuf,
+                             const uint8_t task)
 {
-    linebuf_append(linebuf, rx_fifo);
+    if (usart_route_rx(prefix, rx_fifo, TASK_RX_BUDGET)) {
+        if (fifo_is_not_empty(rx_fifo)) {
+            scheduler_ready(task);
+        }
+        return;
+    }
+
+    linebuf_append(linebuf, rx_fifo, TASK_RX_BUDGET);
     if (linebuf_is_ready(linebuf)) {
-        print_c(prefix);
-        print_n(linebuf->line, linebuf->l);
-        print_end_of_line();
+        if (!usart_jobs_reply(prefix, linebuf->line, linebuf->l)) {
+            print_c(prefix);
+            print_n(linebuf->line, linebuf->l);
+            print_end_of_line();
+        }
         linebuf_reset(linebuf);
     }
+    if (fifo_is_not_empty(rx_fifo)) {
+        scheduler_ready(task);
+    }
 }
 
 
@@ -147,6 +260,7 @@ static void forward_usart_tx(const uint8_t port,
 {
     assert(l >= 1, "Empty Serial Message!");
     assert(port >= (uint8_t)'1' && port <= (uint8_t)'3', "Bad USART!");
+    assert(fifo_arena_usart_is_used(port), "USART Not Used!");
     for (uint8_t i = 0 ; i < l ; i++) {
         switch(port) {
             case '1': usart1_tx(p[i]); break;
@@ -157,6 +271,126 @@ static void forward_usart_tx(const uint8_t port,
 }
 
 
+// Long enough for a full SPI transfer command.
+static linebuf_t* const usart0_linebuf =
+    ALLOCATE_LINEBUF(2 * SPI_BUFFER_SIZE + 8);
+static linebuf_t* const usart1_linebuf = ALLOCATE_LINEBUF(32);
+static linebuf_t* const usart2_linebuf = ALLOCATE_LINEBUF(32);
+static linebuf_t* const usart3_linebuf = ALLOCATE_LINEBUF(32);
+
+
+// Static buffers, for the memory report.
+static const uint16_t g_memory_buffers[] = {
+    sizeof(g_fifo_arena),
+    sizeof(linebuf_t) + 2 * SPI_BUFFER_SIZE + 8,
+    sizeof(linebuf_t) + 32,
+    sizeof(linebuf_t) + 32,
+    sizeof(linebuf_t) + 32,
+    sizeof(g_logic_buffer),
+    sizeof(g_telemetry_buffer),
+    sizeof(g_sequence),
+    sizeof(g_spi_tx) + sizeof(g_spi_rx),
+    sizeof(g_twi_tx) + sizeof(g_twi_rx),
+    sizeof(g_modbus_frame),
+    sizeof(g_recorder),
+    sizeof(g_job),
+    sizeof(g_stepper),
+};
+
+#define MEMORY_BUFFERS (sizeof(g_memory_buffers) / sizeof(g_memory_buffers[0]))
+
+
+// GS   Report "#M<buffer:2><bytes:4>" lines, then respond with the size of
+//      the static data, the stack space and the most stack used since
+//      reset, and the number of buffers.
+// GF   USART FIFO sizes, see fifo_arena.h.
+static void memory_command(const uint8_t* const p, const uint8_t l)
+{
+    if (l >= 2 && p[1] == 'F') {
+        fifo_arena_command(p, l);
+        return;
+    }
+    assert(l == 2 && p[1] == 'S', "Bad Memory Command!");
+
+    for (uint8_t i = 0 ; i < MEMORY_BUFFERS ; i++) {
+        print_c('#');
+        print_c('M');
+        print_hex(i);
+        print_hex16(g_memory_buffers[i]);
+        print_end_of_line();
+    }
+
+    print_c('>');
+    print_n(p, l);
+    print_hex16(sram_static_size());
+    print_hex16(sram_stack_size());
+    print_hex16(sram_stack_size() - sram_stack_unused());
+    print_hex(MEMORY_BUFFERS);
+    print_end_of_line();
+}
+
+
+#ifdef PROFILE
+
+// USART RX and TX FIFOs, for the peak fill level report.
+#define PROFILE_FIFOS FIFO_ARENA_FIFOS
+
+static fifo_t* profile_fifo(const uint8_t i)
+{
+    return *g_fifo_arena_fifos[i];
+}
+
+
+// QR   Report "#P<probe:2><count:4><min:8><max:8><mean:8><histogram:8×4>"
+//      lines (cycles), then "#F<fifo:1><size:2><peak:2>" lines.
+//      Responds with the number of probes and FIFOs.
+// QC   Clear stats and FIFO peaks.
+static void profile_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l == 2, "Bad Profile Command!");
+
+    switch(p[1]) {
+        case 'R': for (uint8_t i = 0 ; i < PROFILE_PROBES ; i++) {
+                      const profile_stats_t st = profile_read(i);
+                      print_c('#');
+                      print_c('P');
+                      print_hex(i);
+                      print_hex16(st.count);
+                      print_hex32(st.min);
+                      print_hex32(st.max);
+                      print_hex32(st.count ? st.sum / st.count : 0);
+                      for (uint8_t b = 0 ; b < PROFILE_BUCKETS ; b++) {
+                          print_hex16(st.histogram[b]);
+                      }
+                      print_end_of_line();
+                  }
+                  for (uint8_t i = 0 ; i < PROFILE_FIFOS ; i++) {
+                      print_c('#');
+                      print_c('F');
+                      print_hex_digit(i);
+                      print_hex(profile_fifo(i)->size);
+                      print_hex(profile_fifo(i)->peak);
+                      print_end_of_line();
+                  }
+                  break;
+        case 'C': profile_clear();
+                  for (uint8_t i = 0 ; i < PROFILE_FIFOS ; i++) {
+                      profile_fifo(i)->peak = 0;
+                  }
+                  break;
+        default: assert(0, "Bad Profile Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    print_hex(PROFILE_PROBES);
+    print_hex(PROFILE_FIFOS);
+    print_end_of_line();
+}
+
+#endif // PROFILE
+
+
 static void process_command(const uint8_t* const p, const uint8_t l)
 {
     // Reset.
@@ -167,16 +401,152 @@ static void process_command(const uint8_t* const p, const uint8_t l)
 
     // Serial.
     if (p[0] >= (uint8_t)'1' && p[0] <= (uint8_t)'3') {
+        PROFILE_BEGIN();
         assert(l >= 2, "Short Serial Message!");
         forward_usart_tx(p[0], p+1, l-1);
         forward_usart_tx(p[0], "\r\n", 2);
         print_c('>');
         print_n(p, l);
         print_end_of_line();
+        PROFILE_END(PROFILE_COMMAND_USART);
+        return;
+    }
+
+    // Input Capture.
+    if (p[0] == 'C') {
+        PROFILE_BEGIN();
+        capture_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_CAPTURE);
+        return;
+    }
+
+    // Sequencer.
+    if (p[0] == 'S') {
+        PROFILE_BEGIN();
+        sequence_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_SEQUENCE);
+        return;
+    }
+
+    // Reflex Rules.
+    if (p[0] == 'R') {
+        PROFILE_BEGIN();
+        reflex_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_REFLEX);
+        return;
+    }
+
+    // Quadrature Encoders.
+    if (p[0] == 'E') {
+        PROFILE_BEGIN();
+        encoder_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_ENCODER);
+        return;
+    }
+
+    // Logic Analyzer.
+    if (p[0] == 'W') {
+        PROFILE_BEGIN();
+        logic_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_LOGIC);
+        return;
+    }
+
+    // Analog Monitors.
+    if (p[0] == 'V') {
+        PROFILE_BEGIN();
+        adc_monitor_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_ANALOG);
+        return;
+    }
+
+    // ADC Telemetry.
+    if (p[0] == 'T') {
+        PROFILE_BEGIN();
+        telemetry_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_TELEMETRY);
+        return;
+    }
+
+    // SPI Master.
+    if (p[0] == 'X') {
+        PROFILE_BEGIN();
+        spi_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_SPI);
+        return;
+    }
+
+    // TWI Master.
+    if (p[0] == 'Y') {
+        PROFILE_BEGIN();
+        twi_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_TWI);
+        return;
+    }
+
+    // USART Polling Jobs.
+    if (p[0] == 'J') {
+        PROFILE_BEGIN();
+        usart_jobs_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_JOBS);
+        return;
+    }
+
+    // USART Routes.
+    if (p[0] == 'O') {
+        PROFILE_BEGIN();
+        usart_routes_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_ROUTES);
+        return;
+    }
+
+    // Flight Recorder.
+    if (p[0] == 'F') {
+        recorder_command(p, l);
+        return;
+    }
+
+    // Stepper Motion.
+    if (p[0] == 'K') {
+        PROFILE_BEGIN();
+        stepper_command(p, l);
+        PROFILE_END(PROFILE_COMMAND_STEPPER);
+        return;
+    }
+
+    // Memory Usage.
+    if (p[0] == 'G') {
+        memory_command(p, l);
+        return;
+    }
+
+    // Modbus RTU.
+    if (p[0] == 'B') {
+        modbus_command(p, l);
+        return;
+    }
+
+    // Snapshot.
+    if (l == 1 && p[0] == 'P') {
+        PROFILE_BEGIN();
+        print_c('>');
+        print_c('P');
+        snapshot();
+        print_end_of_line();
+        PROFILE_END(PROFILE_COMMAND_SNAPSHOT);
+        return;
+    }
+
+#ifdef PROFILE
+    // Profiling Stats.
+    if (p[0] == 'Q') {
+        profile_command(p, l);
         return;
     }
+#endif
 
     // GPIO.
+    PROFILE_BEGIN();
     assert(l >= 3, "Short Command!");
     uint8_t command = p[0];
     uint8_t port = p[1];
@@ -194,7 +564,7 @@ static void process_command(const uint8_t* const p, const uint8_t l)
         case 'I': value = read_input(port, pin_n);           break;
         case 'M': monitor_input(port, pin_n);                break;
         case 'N': unmonitor_input(port, pin_n);              break;
-        case 'A': value = analog_input(port, pin_n);         break;
+        case 'A': value = adc_read(port, pin_n);             break;
     }
 
     print_c('>');
@@ -205,23 +575,111 @@ static void process_command(const uint8_t* const p, const uint8_t l)
         print_hex16(value);
     }
     print_end_of_line();
+    PROFILE_END(PROFILE_COMMAND_GPIO);
 }
 
-static linebuf_t* const usart0_linebuf = ALLOCATE_LINEBUF(32);
-static linebuf_t* const usart1_linebuf = ALLOCATE_LINEBUF(32);
-static linebuf_t* const usart2_linebuf = ALLOCATE_LINEBUF(32);
-static linebuf_t* const usart3_linebuf = ALLOCATE_LINEBUF(32);
+static void adc_sample_ready(const uint8_t channel, const uint16_t value)
+{
+    adc_monitor_sample(channel, value);
+}
+
+
+
+
+/* Tasks */
+
+// Process at most one command per run.
+// Commands wait while an SPI transfer or TWI transaction is running
+// (SPI_DONE_NOTIFY, TWI_DONE_NOTIFY).
+static void command_task(void)
+{
+    if (!spi_poll() || !twi_poll()) {
+        return;
+    }
+    if (modbus_is_enabled()) {
+        modbus_receive();
+        return;
+    }
+    linebuf_append(usart0_linebuf, p_g_usart0_rx_fifo, TASK_RX_BUDGET);
+    if (linebuf_is_ready(usart0_linebuf)) {
+        recorder_record_command(usart0_linebuf->line, usart0_linebuf->l);
+        process_command(usart0_linebuf->line, usart0_linebuf->l);
+        linebuf_reset(usart0_linebuf);
+    }
+    if (fifo_is_not_empty(p_g_usart0_rx_fifo)) {
+        scheduler_ready(TASK_COMMAND);
+    }
+}
+
+
+static void usart1_task(void)
+{
+    forward_usart_rx('1', p_g_usart1_rx_fifo, usart1_linebuf, TASK_USART1);
+}
+
+
+static void usart2_task(void)
+{
+    forward_usart_rx('2', p_g_usart2_rx_fifo, usart2_linebuf, TASK_USART2);
+}
+
+
+static void usart3_task(void)
+{
+    forward_usart_rx('3', p_g_usart3_rx_fifo, usart3_linebuf, TASK_USART3);
+}
+
+
+// Once per millisecond.
+static void tick_task(void)
+{
+    uint8_t dt = ms_clock() - poll_timestamp;
+    if (dt > 20) {
+        poll_ports();
+    }
+
+    capture_poll();
+    sequence_poll();
+    reflex_poll();
+    stepper_poll();
+    encoder_poll();
+    adc_monitor_poll();
+    telemetry_poll();
+    twi_check_timeout();
+    usart_jobs_poll();
+    modbus_poll();
+}
+
+
+static const task_t g_tasks[TASK_COUNT] = {
+    [TASK_COMMAND] = command_task,
+    [TASK_USART1] = usart1_task,
+    [TASK_USART2] = usart2_task,
+    [TASK_USART3] = usart3_task,
+    [TASK_TICK] = tick_task,
+};
 
 
 void main(void) __attribute((noreturn));
 void main()
 {
+    recorder_init();
+    fifo_arena_init();
     usart0_init();
-    usart1_init();
-    usart2_init();
-    usart3_init();
+    if (fifo_arena_usart_is_used('1')) {
+        usart1_init();
+    }
+    if (fifo_arena_usart_is_used('2')) {
+        usart2_init();
+    }
+    if (fifo_arena_usart_is_used('3')) {
+        usart3_init();
+    }
 
     timer2_init();
+#ifdef PROFILE
+    profile_init();
+#endif
 
     sei();
 
@@ -230,22 +688,12 @@ void main()
     print_c('Z');
     print_end_of_line();
 
-    for(;;) {
-
-        linebuf_append(usart0_linebuf, p_g_usart0_rx_fifo);
-        if (linebuf_is_ready(usart0_linebuf)) {
-            process_command(usart0_linebuf->line, usart0_linebuf->l);
-            linebuf_reset(usart0_linebuf);
-        }
-
-        forward_usart_rx('1', p_g_usart1_rx_fifo, usart1_linebuf);
-        forward_usart_rx('2', p_g_usart2_rx_fifo, usart2_linebuf);
-        forward_usart_rx('3', p_g_usart3_rx_fifo, usart3_linebuf);
+    for (uint8_t task = 0 ; task < TASK_COUNT ; task++) {
+        scheduler_ready(task);
+    }
 
-        uint8_t dt = ms_clock() - poll_timestamp;
-        if (dt > 20) {
-            poll_ports();
-        }
+    for(;;) {
+        scheduler_run(g_tasks, TASK_COUNT);
     }
 }
 
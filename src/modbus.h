@@ -0,0 +1,458 @@
+//==============================================================================
+// Modbus RTU Slave on USART0.
+//
+// "BM<address:2>" switches USART0 from the text protocol to Modbus RTU
+// (38400 8N1) until the next reset. Text output (responses, events) is
+// then suppressed.
+//
+// Frames are delimited by 3.5 character times of silence, measured from
+// the RX ISR's timestamp of the last byte on the Timer2 clock (4 us
+// resolution). Above 19200 bps the gaps are fixed at t1.5 = 750 us and
+// t3.5 = 1750 us. A gap longer than t1.5 inside a frame invalidates it;
+// the first byte of a frame is not checked, as the 16-bit clock wraps
+// every 65.536 ms and the idle time before it can't be measured.
+// The frame is checked every millisecond tick, so a response starts
+// 1.75-2.75 ms after the end of the request.
+//
+// Data model (coil and input numbers are port A-L (no I) * 8 + pin):
+//
+//   Coils               PORTx bits. Writing a coil makes the pin an output.
+//   Discrete Inputs     PINx bits.
+//   Input Registers     0-15    ADC channels F0-F7, K0-K7.
+//                       16-17   Millisecond clock (high word first).
+//                       18-     Encoder positions (2 per encoder).
+//
+// Functions: 01 Read Coils, 02 Read Discrete Inputs, 04 Read Input
+// Registers, 05 Write Single Coil, 15 Write Multiple Coils. Broadcast
+// (address 0) writes are applied without a response.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// Modbus: https://modbus.org/docs/Modbus_Application_Protocol_V1_1b3.pdf
+//         https://modbus.org/docs/Modbus_over_serial_line_V1_02.pdf
+//==============================================================================
+
+#ifndef MODBUS_H_INCLUDED
+#define MODBUS_H_INCLUDED
+
+
+#ifndef MODBUS_FRAME_SIZE
+#define MODBUS_FRAME_SIZE 64
+#endif
+
+// Inter-character and inter-frame gaps (us). [Modbus over serial, 2.5.1.1]
+#define MODBUS_T1_5_US 750U
+#define MODBUS_T3_5_US 1750U
+
+static const char g_modbus_ports[] = "ABCDEFGHJKL";
+
+#define MODBUS_BITS ((sizeof(g_modbus_ports) - 1U) * 8U)
+#define MODBUS_INPUT_REGISTERS (18U + 2U * ENCODER_COUNT)
+
+// Exception codes. [Modbus Application Protocol, 7]
+#define MODBUS_ILLEGAL_FUNCTION 1U
+#define MODBUS_ILLEGAL_DATA_ADDRESS 2U
+#define MODBUS_ILLEGAL_DATA_VALUE 3U
+
+
+static uint8_t g_modbus_address = 0;            // 0 = text protocol.
+static uint8_t g_modbus_frame[MODBUS_FRAME_SIZE];
+static uint8_t g_modbus_l = 0;
+static bool g_modbus_overrun = false;
+static volatile uint16_t g_modbus_rx_time = 0;  // Last byte received (us).
+static volatile bool g_modbus_rx_gap = false;   // t1.5 gap within frame.
+static volatile bool g_modbus_rx_active = false; // Frame being received.
+static uint16_t g_modbus_tx_crc = 0;
+
+
+// CRC-16 (polynomial 0xA001 reflected, initial value 0xFFFF).
+// [Modbus over serial, 6.2.2]
+static const uint16_t g_modbus_crc_table[256] PROGMEM = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+
+static uint16_t modbus_crc_update(const uint16_t crc, const uint8_t c)
+{
+    return (crc >> 8U)
+         ^ pgm_read_word(&g_modbus_crc_table[(uint8_t)(crc ^ c)]);
+}
+
+
+static bool modbus_is_enabled(void) { return g_modbus_address != 0; }
+
+
+// Called from the USART0 RX ISR.
+static void modbus_rx_notify(void)
+{
+    if (!modbus_is_enabled()) {
+        return;
+    }
+    const uint16_t t = timer2_us_clock16();
+    const uint16_t gap = t - g_modbus_rx_time;
+    if (g_modbus_rx_active
+    &&  gap > MODBUS_T1_5_US && gap < MODBUS_T3_5_US) {
+        g_modbus_rx_gap = true;
+    }
+    g_modbus_rx_active = true;
+    g_modbus_rx_time = t;
+}
+
+
+
+/* Data Model */
+
+static uint8_t modbus_bit(const uint16_t n, const bool input)
+{
+    const uint8_t port = (uint8_t)g_modbus_ports[n >> 3U];
+    const volatile uint8_t* const r = input ? gpio_pin_register(port)
+                                            : gpio_port_register(port);
+    return (*r >> (n & 7U)) & 1U;
+}
+
+
+static void modbus_write_coil(const uint16_t n, const bool value)
+{
+    const uint8_t port = (uint8_t)g_modbus_ports[n >> 3U];
+    if (value) {
+        output_high(port, n & 7U);
+    } else {
+        output_low(port, n & 7U);
+    }
+}
+
+
+// 32-bit value behind input registers 16 + 2k, 17 + 2k.
+static uint32_t modbus_input_wide(const uint8_t k)
+{
+    if (k == 0) {
+        return ms_clock32();
+    }
+    return (uint32_t)encoder_position(&g_encoder[k - 1U]);
+}
+
+
+
+/* Response */
+
+static void modbus_tx_start(void)
+{
+    g_modbus_tx_crc = 0xFFFFU;
+}
+
+
+static void modbus_tx(const uint8_t c)
+{
+    usart0_tx(c);
+    g_modbus_tx_crc = modbus_crc_update(g_modbus_tx_crc, c);
+}
+
+
+static void modbus_tx16(const uint16_t x)
+{
+    modbus_tx(x >> 8U);
+    modbus_tx(x & 0xFFU);
+}
+
+
+static void modbus_tx_end(void)
+{
+    const uint16_t crc = g_modbus_tx_crc;
+    usart0_tx(crc & 0xFFU);
+    usart0_tx(crc >> 8U);
+}
+
+
+static void modbus_exception(const uint8_t function, const uint8_t code)
+{
+    modbus_tx_start();
+    modbus_tx(g_modbus_address);
+    modbus_tx(function | 0x80U);
+    modbus_tx(code);
+    modbus_tx_end();
+}
+
+
+
+/* Requests */
+
+static uint16_t modbus_u16(const uint8_t* const p)
+{
+    return (uint16_t)((p[0] << 8U) | p[1]);
+}
+
+
+// 01 Read Coils, 02 Read Discrete Inputs.
+static uint8_t modbus_read_bits(const uint8_t* const f, const uint8_t l)
+{
+    const uint16_t start = modbus_u16(f + 2);
+    const uint16_t count = modbus_u16(f + 4);
+    if (l != 6 || count == 0 || count > 2000U) {
+        return MODBUS_ILLEGAL_DATA_VALUE;
+    }
+    if (start >= MODBUS_BITS || count > MODBUS_BITS - start) {
+        return MODBUS_ILLEGAL_DATA_ADDRESS;
+    }
+
+    modbus_tx_start();
+    modbus_tx(g_modbus_address);
+    modbus_tx(f[1]);
+    modbus_tx((uint8_t)((count + 7U) / 8U));
+    uint8_t byte = 0;
+    for (uint16_t i = 0 ; i < count ; i++) {
+        byte |= (uint8_t)(modbus_bit(start + i, f[1] == 2) << (i & 7U));
+        if ((i & 7U) == 7U || i + 1U == count) {
+            modbus_tx(byte);
+            byte = 0;
+        }
+    }
+    modbus_tx_end();
+    return 0;
+}
+
+
+// 04 Read Input Registers.
+static uint8_t modbus_read_input_registers(const uint8_t* const f,
+                                           const uint8_t l)
+{
+    const uint16_t start = modbus_u16(f + 2);
+    const uint16_t count = modbus_u16(f + 4);
+    if (l != 6 || count == 0 || count > 125U) {
+        return MODBUS_ILLEGAL_DATA_VALUE;
+    }
+    if (start >= MODBUS_INPUT_REGISTERS
+    ||  count > MODBUS_INPUT_REGISTERS - start) {
+        return MODBUS_ILLEGAL_DATA_ADDRESS;
+    }
+
+    modbus_tx_start();
+    modbus_tx(g_modbus_address);
+    modbus_tx(f[1]);
+    modbus_tx((uint8_t)(count * 2U));
+    uint32_t wide = 0;
+    for (uint16_t r = start ; r < start + count ; r++) {
+        if (r < 16U) {
+            modbus_tx16(adc_read(r < 8U ? 'F' : 'K', r & 7U));
+            continue;
+        }
+        // Both halves of a 32-bit value come from one read.
+        const uint8_t k = (uint8_t)((r - 16U) / 2U);
+        const bool high = ((r - 16U) & 1U) == 0;
+        if (high || r == start) {
+            wide = modbus_input_wide(k);
+        }
+        modbus_tx16(high ? (uint16_t)(wide >> 16U) : (uint16_t)wide);
+    }
+    modbus_tx_end();
+    return 0;
+}
+
+
+// 05 Write Single Coil.
+static uint8_t modbus_write_single_coil(const uint8_t* const f,
+                                        const uint8_t l, const bool reply)
+{
+    const uint16_t n = modbus_u16(f + 2);
+    const uint16_t value = modbus_u16(f + 4);
+    if (l != 6 || (value != 0xFF00U && value != 0)) {
+        return MODBUS_ILLEGAL_DATA_VALUE;
+    }
+    if (n >= MODBUS_BITS) {
+        return MODBUS_ILLEGAL_DATA_ADDRESS;
+    }
+    modbus_write_coil(n, value != 0);
+
+    if (reply) {
+        modbus_tx_start();
+        for (uint8_t i = 0 ; i < 6 ; i++) {
+            modbus_tx(f[i]);
+        }
+        modbus_tx_end();
+    }
+    return 0;
+}
+
+
+// 15 Write Multiple Coils.
+static uint8_t modbus_write_multiple_coils(const uint8_t* const f,
+                                           const uint8_t l, const bool reply)
+{
+    const uint16_t start = modbus_u16(f + 2);
+    const uint16_t count = modbus_u16(f + 4);
+    if (l < 8 || count == 0 || count > 1968U
+    ||  f[6] != (count + 7U) / 8U || l != 7U + f[6]) {
+        return MODBUS_ILLEGAL_DATA_VALUE;
+    }
+    if (start >= MODBUS_BITS || count > MODBUS_BITS - start) {
+        return MODBUS_ILLEGAL_DATA_ADDRESS;
+    }
+    for (uint16_t i = 0 ; i < count ; i++) {
+        modbus_write_coil(start + i, (f[7 + i / 8U] >> (i & 7U)) & 1U);
+    }
+
+    if (reply) {
+        modbus_tx_start();
+        for (uint8_t i = 0 ; i < 6 ; i++) {
+            modbus_tx(f[i]);
+        }
+        modbus_tx_end();
+    }
+    return 0;
+}
+
+
+static void modbus_process(const uint8_t* const f, const uint8_t l)
+{
+    if (l < 4) {
+        return;
+    }
+    uint16_t crc = 0xFFFFU;
+    for (uint8_t i = 0 ; i < l ; i++) {
+        crc = modbus_crc_update(crc, f[i]);
+    }
+    if (crc != 0) {
+        return;
+    }
+    const bool broadcast = f[0] == 0;
+    if (!broadcast && f[0] != g_modbus_address) {
+        return;
+    }
+
+    const uint8_t n = l - 2U;                   // Without CRC.
+    uint8_t exception = MODBUS_ILLEGAL_FUNCTION;
+    switch(f[1]) {
+        case 1:
+        case 2: if (!broadcast) {
+                    exception = modbus_read_bits(f, n);
+                }
+                break;
+        case 4: if (!broadcast) {
+                    exception = modbus_read_input_registers(f, n);
+                }
+                break;
+        case 5: exception = modbus_write_single_coil(f, n, !broadcast); break;
+        case 15: exception = modbus_write_multiple_coils(f, n, !broadcast);
+                 break;
+    }
+    if (exception != 0 && !broadcast) {
+        modbus_exception(f[1], exception);
+    }
+}
+
+
+
+/* Frames */
+
+// Move received bytes into the frame buffer.
+static void modbus_receive(void)
+{
+    while (fifo_is_not_empty(p_g_usart0_rx_fifo)) {
+        const uint8_t c = fifo_read(p_g_usart0_rx_fifo);
+        if (g_modbus_l < MODBUS_FRAME_SIZE) {
+            g_modbus_frame[g_modbus_l++] = c;
+        } else {
+            g_modbus_overrun = true;
+        }
+    }
+}
+
+
+// Once per millisecond: process the frame after t3.5 of silence.
+static void modbus_poll(void)
+{
+    if (!modbus_is_enabled()) {
+        return;
+    }
+    modbus_receive();
+    if (g_modbus_l == 0 && !g_modbus_overrun) {
+        return;
+    }
+
+    // The end of the frame is taken with the ISR's state, so a byte that
+    // arrives just after it starts the next frame.
+    bool end = false;
+    bool gap = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        const uint16_t silence = timer2_us_clock16() - g_modbus_rx_time;
+        if (silence >= MODBUS_T3_5_US
+        &&  fifo_is_empty(p_g_usart0_rx_fifo)) {
+            end = true;
+            gap = g_modbus_rx_gap;
+            g_modbus_rx_gap = false;
+            g_modbus_rx_active = false;
+        }
+    }
+    if (!end) {
+        return;
+    }
+
+    if (!gap && !g_modbus_overrun) {
+        modbus_process(g_modbus_frame, g_modbus_l);
+    }
+    g_modbus_l = 0;
+    g_modbus_overrun = false;
+}
+
+
+
+/* Commands */
+
+// BM<address:2>    Switch USART0 to Modbus RTU slave <address> (1-247)
+//                  until reset.
+static void modbus_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l == 4 && p[1] == 'M', "Bad Modbus Command!");
+    const uint8_t address = (uint8_t)parse_hex(p + 2, 2);
+    assert(address >= 1 && address <= 247, "Bad Modbus Address!");
+
+    print_c('>');
+    print_n(p, l);
+    print_end_of_line();
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        g_modbus_rx_time = timer2_us_clock16();
+        g_modbus_rx_gap = false;
+        g_modbus_rx_active = false;
+    }
+    g_modbus_l = 0;
+    g_modbus_address = address;
+}
+
+
+
+#endif // MODBUS_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
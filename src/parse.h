@@ -0,0 +1,37 @@
+//==============================================================================
+// Parse command arguments.
+// 
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef PARSE_H_INCLUDED
+#define PARSE_H_INCLUDED
+
+
+static uint8_t parse_hex_digit(const uint8_t c)
+{
+    if (c >= (uint8_t)'0' && c <= (uint8_t)'9') { return c - (uint8_t)'0'; }
+    if (c >= (uint8_t)'A' && c <= (uint8_t)'F') { return c - (uint8_t)'A' + 10U; }
+    if (c >= (uint8_t)'a' && c <= (uint8_t)'f') { return c - (uint8_t)'a' + 10U; }
+    assert(0, "Bad Hex Digit!");
+    return 0;
+}
+
+
+// Parse `n` hex digits starting at `p` (most significant digit first).
+static uint32_t parse_hex(const uint8_t* const p, const uint8_t n)
+{
+    uint32_t x = 0;
+    for (uint8_t i = 0 ; i < n ; i++) {
+        x = (x << 4U) | parse_hex_digit(p[i]);
+    }
+    return x;
+}
+
+
+
+#endif // PARSE_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
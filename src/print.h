@@ -27,15 +27,18 @@ void print_n(const uint8_t* const p, const uint8_t n)
 }
 
 
-static void print_hex(const uint8_t x)
+static void print_hex_digit(uint8_t n)
 {
-    uint8_t n = x >> 4U;
+    n &= 0x0FU;
     n += (n > 9U) ? ((uint8_t)'A' - 10U) : '0';
     print_c(n);
+}
 
-    n = x & 0x0FU;
-    n += (n > 9U) ? ((uint8_t)'A' - 10U) : '0';
-    print_c(n);
+
+static void print_hex(const uint8_t x)
+{
+    print_hex_digit(x >> 4U);
+    print_hex_digit(x);
 }
 
 
@@ -46,6 +49,13 @@ static void print_hex16(const uint16_t x)
 }
 
 
+static void print_hex32(const uint32_t x)
+{
+    print_hex16(x >> 16U);
+    print_hex16(x & 0xFFFFU);
+}
+
+
 static void print_end_of_line(void)
 {
     print_c('\r');
@@ -53,9 +63,16 @@ static void print_end_of_line(void)
 }
 
 
+// Called by error() with interrupts disabled.
+#ifndef ERROR_NOTIFY
+#define ERROR_NOTIFY(code, message)
+#endif
+
+
 static void error(const uint16_t code, const char* const message)
 {
     cli();
+    ERROR_NOTIFY(code, message);
 
     print_end_of_line();
     print("ERROR ");
@@ -0,0 +1,189 @@
+//==============================================================================
+// Profiling Instrumentation.
+//
+// Build with -DPROFILE to measure how long scheduler passes, command
+// handlers and ISRs take, in CPU cycles. Without PROFILE the PROFILE_BEGIN
+// and PROFILE_END macros expand to nothing and this file adds no code or
+// data.
+//
+// Timer/Counter 5 runs free at clk/1 as the cycle counter, extended to
+// 32 bits by its overflow interrupt (so it is not available for Input
+// Capture on ICP5/T5 in profiling builds). ISR times do not include the
+// compiler generated prologue and epilogue.
+//
+// Each probe keeps count, min, max, sum and a histogram with buckets at
+// powers of 4 from 64 cycles (4 us): <64, <256, <1K, <4K, <16K, <64K,
+// <256K and the rest.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef PROFILE_H_INCLUDED
+#define PROFILE_H_INCLUDED
+
+
+#ifndef PROFILE
+
+#define PROFILE_BEGIN()
+#define PROFILE_END(probe)
+
+#else
+
+#define PROFILE_BEGIN() const uint32_t profile_t0 = profile_now()
+#define PROFILE_END(probe) profile_record((probe), profile_now() - profile_t0)
+
+
+enum {
+    PROFILE_PASS,                   // Scheduler pass (excluding sleep).
+    PROFILE_COMMAND_GPIO,
+    PROFILE_COMMAND_USART,
+    PROFILE_COMMAND_CAPTURE,
+    PROFILE_COMMAND_SEQUENCE,
+    PROFILE_COMMAND_REFLEX,
+    PROFILE_COMMAND_ENCODER,
+    PROFILE_COMMAND_LOGIC,
+    PROFILE_COMMAND_ANALOG,
+    PROFILE_COMMAND_TELEMETRY,
+    PROFILE_COMMAND_SNAPSHOT,
+    PROFILE_COMMAND_SPI,
+    PROFILE_COMMAND_TWI,
+    PROFILE_COMMAND_JOBS,
+    PROFILE_COMMAND_ROUTES,
+    PROFILE_COMMAND_STEPPER,
+    PROFILE_ISR_USART0_RX,
+    PROFILE_ISR_USART0_TX,
+    PROFILE_ISR_USART1_RX,
+    PROFILE_ISR_USART1_TX,
+    PROFILE_ISR_USART2_RX,
+    PROFILE_ISR_USART2_TX,
+    PROFILE_ISR_USART3_RX,
+    PROFILE_ISR_USART3_TX,
+    PROFILE_ISR_TIMER2,
+    PROFILE_ISR_CAPTURE,
+    PROFILE_ISR_SEQUENCE,
+    PROFILE_ISR_ENCODER,
+    PROFILE_ISR_ADC,
+    PROFILE_ISR_SPI,
+    PROFILE_ISR_TWI,
+    PROFILE_ISR_STEPPER,
+    PROFILE_ISR_STEPPER_PLAN,       // Includes ISRs nested in it.
+    PROFILE_ISR_REFLEX,
+    PROFILE_PROBES
+};
+
+#define PROFILE_BUCKETS 8U
+
+
+typedef struct {
+    uint16_t count;                 // Stops at 0xFFFF (or sum overflow).
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+    uint16_t histogram[PROFILE_BUCKETS];
+} profile_stats_t;
+
+
+static profile_stats_t g_profile[PROFILE_PROBES];
+static volatile uint16_t g_profile_overflows = 0;
+
+
+ISR(TIMER5_OVF_vect)
+{
+    g_profile_overflows++;
+}
+
+
+// 32-bit cycle count. Works with interrupts disabled (in an ISR) by
+// checking for a pending overflow. [DS40002211A, 17.3, 17.11.39]
+static uint32_t profile_now(void)
+{
+    uint16_t overflows;
+    uint16_t t;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        overflows = g_profile_overflows;
+        t = TCNT5;
+        if ((TIFR5 & bit1(TOV5)) && t < 0x8000U) {
+            overflows++;
+        }
+    }
+    return ((uint32_t)overflows << 16U) | t;
+}
+
+
+static uint8_t profile_bucket(uint32_t t)
+{
+    uint8_t bucket = 0;
+    t >>= 6U;
+    while (t != 0 && bucket < PROFILE_BUCKETS - 1U) {
+        bucket++;
+        t >>= 2U;
+    }
+    return bucket;
+}
+
+
+static void profile_record(const uint8_t probe, const uint32_t t)
+{
+    profile_stats_t* const s = &g_profile[probe];
+    if (s->count == 0 || t < s->min) {
+        s->min = t;
+    }
+    if (t > s->max) {
+        s->max = t;
+    }
+    if (s->count != 0xFFFFU && s->sum + t >= s->sum) {
+        s->count++;
+        s->sum += t;
+    }
+    uint16_t* const h = &s->histogram[profile_bucket(t)];
+    if (*h != 0xFFFFU) {
+        (*h)++;
+    }
+}
+
+
+static void profile_clear(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0 ; i < PROFILE_PROBES ; i++) {
+            g_profile[i] = (profile_stats_t){0};
+        }
+    }
+}
+
+
+// Copy a probe's stats (ISR probes change under interrupts).
+static profile_stats_t profile_read(const uint8_t probe)
+{
+    profile_stats_t s;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        s = g_profile[probe];
+    }
+    return s;
+}
+
+
+// Normal mode, clk/1, overflow interrupt.
+// [DS40002211A, 17.9.1, Table 17-6]
+static void profile_init(void)
+{
+    timer_claim(5, 'Q');
+    timer_power_on(5);
+    TCCR5A = 0;
+    TCCR5B = bit1(CS50);
+    TIFR5 = bit1(TOV5);
+    TIMSK5 = bit1(TOIE5);
+}
+
+#endif // PROFILE
+
+
+
+#endif // PROFILE_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,213 @@
+//==============================================================================
+// Flight Recorder.
+//
+// Keeps the last RECORDER_SIZE commands and events ("!" lines), with
+// their time and up to RECORDER_TEXT_SIZE characters each, and the code,
+// message and time of the last error(). The record lives in .noinit SRAM,
+// which the C runtime does not clear, so it survives the watchdog reset
+// that follows an error. After a power-on the SRAM content is random and
+// the record is cleared (magic number check).
+//
+// "FR" reports the record after boot, with the reset cause from MCUSR.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef RECORDER_H_INCLUDED
+#define RECORDER_H_INCLUDED
+
+
+#ifndef RECORDER_SIZE
+#define RECORDER_SIZE 16
+#endif
+
+#ifndef RECORDER_TEXT_SIZE
+#define RECORDER_TEXT_SIZE 16
+#endif
+
+#define RECORDER_MAGIC 0xF17EU
+
+
+typedef struct {
+    uint32_t time;
+    uint8_t kind;                   // 'C' = command, 'E' = event.
+    uint8_t l;
+    uint8_t text[RECORDER_TEXT_SIZE];
+} recorder_entry_t;
+
+
+typedef struct {
+    uint16_t magic;
+    uint16_t magic_inverse;
+    uint8_t next;                   // Entry to overwrite next.
+    uint8_t count;
+    recorder_entry_t entry[RECORDER_SIZE];
+    bool error;
+    uint16_t error_code;
+    uint32_t error_time;
+    const char* error_message;      // String literal, same after reset.
+} recorder_t;
+
+
+static recorder_t g_recorder __attribute__ ((section (".noinit")));
+
+// Reset cause (MCUSR) of this boot.
+static uint8_t g_recorder_reset_cause = 0;
+
+// Event line being printed.
+static recorder_entry_t g_recorder_event;
+static bool g_recorder_line_start = true;
+
+
+static void recorder_clear(void)
+{
+    g_recorder.magic = RECORDER_MAGIC;
+    g_recorder.magic_inverse = (uint16_t)~RECORDER_MAGIC;
+    g_recorder.next = 0;
+    g_recorder.count = 0;
+    g_recorder.error = false;
+}
+
+
+// Call first thing at boot. Clears the reset flags so the next reset
+// cause is not mixed with this one, and stops the watchdog left running
+// by error(). [DS40002211A, 12.5.1, 12.5.2]
+static void recorder_init(void)
+{
+    g_recorder_reset_cause = MCUSR;
+    MCUSR = 0;
+    wdt_disable();
+
+    if (g_recorder.magic != RECORDER_MAGIC
+    ||  g_recorder.magic_inverse != (uint16_t)~RECORDER_MAGIC
+    ||  g_recorder.next >= RECORDER_SIZE
+    ||  g_recorder.count > RECORDER_SIZE) {
+        recorder_clear();
+    }
+}
+
+
+static void recorder_commit(const recorder_entry_t* const e)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        g_recorder.entry[g_recorder.next] = *e;
+        g_recorder.next = (uint8_t)((g_recorder.next + 1U) % RECORDER_SIZE);
+        if (g_recorder.count < RECORDER_SIZE) {
+            g_recorder.count++;
+        }
+    }
+}
+
+
+static void recorder_record_command(const uint8_t* const p, const uint8_t l)
+{
+    recorder_entry_t e = {.time = ms_clock32(), .kind = 'C'};
+    e.l = l < RECORDER_TEXT_SIZE ? l : RECORDER_TEXT_SIZE;
+    for (uint8_t i = 0 ; i < e.l ; i++) {
+        e.text[i] = p[i];
+    }
+    recorder_commit(&e);
+}
+
+
+// Called for each character of text output, records "!" lines.
+static void recorder_output(const uint8_t c)
+{
+    if (c == '\r' || c == '\n') {
+        if (g_recorder_event.kind != 0) {
+            recorder_commit(&g_recorder_event);
+            g_recorder_event.kind = 0;
+        }
+        g_recorder_line_start = true;
+        return;
+    }
+    if (g_recorder_line_start) {
+        g_recorder_line_start = false;
+        if (c == '!') {
+            g_recorder_event.time = ms_clock32();
+            g_recorder_event.kind = 'E';
+            g_recorder_event.l = 0;
+        }
+        return;
+    }
+    if (g_recorder_event.kind != 0
+    &&  g_recorder_event.l < RECORDER_TEXT_SIZE) {
+        g_recorder_event.text[g_recorder_event.l++] = c;
+    }
+}
+
+
+// Called from error() (interrupts disabled).
+static void recorder_error(const uint16_t code, const char* const message)
+{
+    g_recorder.error = true;
+    g_recorder.error_code = code;
+    g_recorder.error_time = g_timer2_clock;
+    g_recorder.error_message = message;
+}
+
+
+
+/* Commands */
+
+// FR   Report "#R<reset cause:2><error:1><code:4><time:8><message>"
+//      then "#E<time:8><kind><text>" entries, oldest first.
+//      Responds with the number of entries.
+// FC   Clear the record.
+static void recorder_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l == 2, "Bad Recorder Command!");
+
+    uint8_t count = 0;
+    switch(p[1]) {
+        case 'R': {
+            print_c('#');
+            print_c('R');
+            print_hex(g_recorder_reset_cause);
+            print_hex_digit(g_recorder.error);
+            print_hex16(g_recorder.error ? g_recorder.error_code : 0);
+            print_hex32(g_recorder.error ? g_recorder.error_time : 0);
+            if (g_recorder.error) {
+                print(g_recorder.error_message);
+            }
+            print_end_of_line();
+
+            // Nothing is recorded while this runs ("#" lines are not).
+            count = g_recorder.count;
+            uint8_t i = (uint8_t)((g_recorder.next + RECORDER_SIZE - count)
+                                  % RECORDER_SIZE);
+            for (uint8_t n = 0 ; n < count ; n++) {
+                const recorder_entry_t* const e = &g_recorder.entry[i];
+                print_c('#');
+                print_c('E');
+                print_hex32(e->time);
+                print_c(e->kind);
+                print_n(e->text, e->l);
+                print_end_of_line();
+                i = (uint8_t)((i + 1U) % RECORDER_SIZE);
+            }
+            break;
+        }
+        case 'C': ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                      recorder_clear();
+                  }
+                  break;
+        default: assert(0, "Bad Recorder Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    print_hex(count);
+    print_end_of_line();
+}
+
+
+
+#endif // RECORDER_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,275 @@
+//==============================================================================
+// Local Reflex Rules.
+//
+// "When input pin X goes H (or L), stable for D ms, wait T ms then set the
+// `mask` bits of output port Y to `value`, and report it."
+//
+// Outputs react without waiting for a host round trip. The host is only
+// notified, by the 1 ms tick task.
+//
+// Trigger pins with an interrupt are evaluated in their ISR, so a rule
+// without debounce or delay sets its output within microseconds of the
+// edge: PCINT0-7 (Port B), PCINT8 (PE0), PCINT9-15 (PJ0-6), INT0-3
+// (PD0-3) and INT4-7 (PE4-7). Port K pin changes belong to the encoder
+// decoder. Other trigger pins, and debounce and delay times, are handled
+// by the tick task once per millisecond.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef REFLEX_H_INCLUDED
+#define REFLEX_H_INCLUDED
+
+
+#ifndef REFLEX_SIZE
+#define REFLEX_SIZE 8
+#endif
+
+
+typedef struct {
+    volatile uint8_t* pin;          // Trigger PINx (0 = rule unused).
+    uint8_t pin_mask;
+    uint8_t edge;                   // 'H' or 'L'.
+    uint8_t debounce;               // ms the new level must be stable.
+    uint16_t delay;                 // ms from trigger to action.
+    volatile uint8_t* port;         // Action PORTx.
+    uint8_t mask;
+    uint8_t value;
+    uint8_t state;                  // Debounced input level.
+    bool bouncing;
+    bool pending;
+    bool fired;                     // Output set, not yet reported.
+    uint16_t bounce_time;
+    uint16_t trigger_time;
+} reflex_t;
+
+
+static reflex_t g_reflex[REFLEX_SIZE];
+
+
+// Called with interrupts disabled. Main context writes to the same port
+// are atomic too (avr_gpio.h), so neither side loses the other's bits.
+static void reflex_action(reflex_t* const r)
+{
+    *r->port = (*r->port & (uint8_t)~r->mask) | (r->value & r->mask);
+    r->pending = false;
+    r->fired = true;
+}
+
+
+static void reflex_trigger(reflex_t* const r, const uint16_t now)
+{
+    if (r->state != (r->edge == 'H')) {
+        return;
+    }
+    if (r->delay == 0) {
+        reflex_action(r);
+    } else {
+        r->pending = true;
+        r->trigger_time = now;
+    }
+}
+
+
+// Evaluate rule `r`, called with interrupts disabled.
+static void reflex_update(reflex_t* const r, const uint16_t now)
+{
+    const uint8_t level = (*r->pin & r->pin_mask) != 0;
+    if (level == r->state) {
+        r->bouncing = false;
+    } else if (r->debounce == 0) {
+        r->state = level;
+        reflex_trigger(r, now);
+    } else if (!r->bouncing) {
+        r->bouncing = true;
+        r->bounce_time = now;
+    } else if ((uint16_t)(now - r->bounce_time) >= r->debounce) {
+        r->bouncing = false;
+        r->state = level;
+        reflex_trigger(r, now);
+    }
+
+    if (r->pending && (uint16_t)(now - r->trigger_time) >= r->delay) {
+        reflex_action(r);
+    }
+}
+
+
+// Evaluate the rules triggered by `pin` (PINx), from its ISR.
+static void reflex_pin_change(const volatile uint8_t* const pin)
+{
+    const uint16_t now = (uint16_t)ms_clock32();
+    for (uint8_t i = 0 ; i < REFLEX_SIZE ; i++) {
+        reflex_t* const r = &g_reflex[i];
+        if (r->pin == pin) {
+            reflex_update(r, now);
+        }
+    }
+}
+
+
+#define REFLEX_ISR(vector, pin) \
+ISR(vector) \
+{ \
+    PROFILE_BEGIN(); \
+    reflex_pin_change(pin); \
+    PROFILE_END(PROFILE_ISR_REFLEX); \
+}
+
+REFLEX_ISR(PCINT0_vect, &PINB)
+REFLEX_ISR(INT0_vect, &PIND)
+REFLEX_ISR(INT1_vect, &PIND)
+REFLEX_ISR(INT2_vect, &PIND)
+REFLEX_ISR(INT3_vect, &PIND)
+REFLEX_ISR(INT4_vect, &PINE)
+REFLEX_ISR(INT5_vect, &PINE)
+REFLEX_ISR(INT6_vect, &PINE)
+REFLEX_ISR(INT7_vect, &PINE)
+
+ISR(PCINT1_vect)
+{
+    PROFILE_BEGIN();
+    reflex_pin_change(&PINE);
+    reflex_pin_change(&PINJ);
+    PROFILE_END(PROFILE_ISR_REFLEX);
+}
+
+
+// Enable the pin change and external interrupts of the trigger pins.
+// ISCn = 01: any edge. INTn is off while ISCn changes and its flag is
+// cleared before it is enabled. [DS40002211A, 15.2.1-15.2.8]
+static void reflex_update_interrupts(void)
+{
+    uint8_t pcmsk0 = 0;
+    uint8_t pcmsk1 = 0;
+    uint8_t eimsk = 0;
+    for (uint8_t i = 0 ; i < REFLEX_SIZE ; i++) {
+        const reflex_t* const r = &g_reflex[i];
+        if (r->pin == &PINB) {
+            pcmsk0 |= r->pin_mask;
+        } else if (r->pin == &PINJ) {
+            pcmsk1 |= (uint8_t)(r->pin_mask << 1U);     // No PCINT on PJ7.
+        } else if (r->pin == &PINE) {
+            pcmsk1 |= r->pin_mask & 0x01U;
+            eimsk |= r->pin_mask & 0xF0U;
+        } else if (r->pin == &PIND) {
+            eimsk |= r->pin_mask & 0x0FU;
+        }
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        EIMSK = 0;
+        EICRA = 0x55;
+        EICRB = 0x55;
+        EIFR = 0xFF;
+        EIMSK = eimsk;
+
+        PCMSK0 = pcmsk0;
+        PCMSK1 = pcmsk1;
+        PCICR = (uint8_t)(PCICR & ~bit2(PCIE0, PCIE1))
+              | (pcmsk0 ? bit1(PCIE0) : 0U)
+              | (pcmsk1 ? bit1(PCIE1) : 0U);
+    }
+}
+
+
+// Evaluate rules without a pin interrupt, debounce and delay times, and
+// report outputs set since the last poll.
+static void reflex_poll(void)
+{
+    const uint16_t now = (uint16_t)ms_clock32();
+
+    for (uint8_t i = 0 ; i < REFLEX_SIZE ; i++) {
+        reflex_t* const r = &g_reflex[i];
+        bool fired = false;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            if (r->pin != 0) {
+                reflex_update(r, now);
+                fired = r->fired;
+                r->fired = false;
+            }
+        }
+
+        if (fired) {
+            print_c('!');
+            print_c('R');
+            print_hex(i);
+            print_c(r->edge);
+            print_end_of_line();
+        }
+    }
+}
+
+
+
+/* Commands */
+
+// RS<i><port><pin><H|L><debounce:2><delay:4><port><mask:2><value:2>
+//                                  Set rule i (0-7). Output pins become
+//                                  outputs. Times in ms.
+// RX<i>                            Delete rule i.
+// RC                               Delete all rules.
+static void reflex_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 2, "Short Reflex Command!");
+
+    switch(p[1]) {
+        case 'S': {
+            assert(l == 17, "Bad Reflex Rule!");
+            const uint8_t i = parse_hex_digit(p[2]);
+            assert(i < REFLEX_SIZE, "Bad Reflex Rule Number!");
+            assert(p[4] >= (uint8_t)'0' && p[4] <= (uint8_t)'7',
+                   "Bad GPIO Pin!");
+            assert(p[5] == 'H' || p[5] == 'L', "Bad Reflex Edge!");
+            const uint8_t pin_mask = bit1(p[4] - (uint8_t)'0');
+            reflex_t* const r = &g_reflex[i];
+            *gpio_ddr_register(p[12]) |= (uint8_t)parse_hex(p + 13, 2);
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                r->pin_mask = pin_mask;
+                r->edge = p[5];
+                r->debounce = (uint8_t)parse_hex(p + 6, 2);
+                r->delay = (uint16_t)parse_hex(p + 8, 4);
+                r->port = gpio_port_register(p[12]);
+                r->mask = (uint8_t)parse_hex(p + 13, 2);
+                r->value = (uint8_t)parse_hex(p + 15, 2);
+                r->state = read_input(p[3], p[4] - (uint8_t)'0') != 0;
+                r->bouncing = false;
+                r->pending = false;
+                r->fired = false;
+                r->pin = gpio_pin_register(p[3]);
+            }
+        } break;
+        case 'X': {
+            assert(l == 3, "Bad Reflex Rule Number!");
+            const uint8_t i = parse_hex_digit(p[2]);
+            assert(i < REFLEX_SIZE, "Bad Reflex Rule Number!");
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                g_reflex[i].pin = 0;
+            }
+        } break;
+        case 'C':
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                for (uint8_t i = 0 ; i < REFLEX_SIZE ; i++) {
+                    g_reflex[i].pin = 0;
+                }
+            }
+            break;
+        default: assert(0, "Bad Reflex Command!");
+    }
+    reflex_update_interrupts();
+
+    print_c('>');
+    print_n(p, l);
+    print_end_of_line();
+}
+
+
+
+#endif // REFLEX_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
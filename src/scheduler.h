@@ -0,0 +1,89 @@
+//==============================================================================
+// Cooperative Task Scheduler.
+//
+// Each task has a ready flag. ISRs set flags when there is work to do
+// (a received byte, a timer tick). One scheduler pass runs every ready
+// task once, in order, and each task does a bounded amount of work before
+// returning, re-setting its own flag if more work remains. When no task
+// is ready the CPU sleeps in Idle mode until the next interrupt.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+
+typedef void (*task_t)(void);
+
+
+static volatile uint8_t g_scheduler_ready = 0;
+
+
+// Mark task ready (from an ISR, interrupts already disabled).
+static void scheduler_ready_from_isr(const uint8_t task)
+{
+    g_scheduler_ready |= (uint8_t)(1U << task);
+}
+
+
+// Mark task ready (from a task).
+static void scheduler_ready(const uint8_t task)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        scheduler_ready_from_isr(task);
+    }
+}
+
+
+// Sleep in Idle mode unless a task became ready.
+// The instruction after SEI is always executed before a pending
+// interrupt, so a wake-up between the check and SLEEP is not lost.
+// [DS40002211A, 7.8, 11.2]
+static void scheduler_idle(void)
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cli();
+    if (g_scheduler_ready == 0) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+}
+
+
+// Run each ready task once.
+static void scheduler_run(const task_t* const tasks, const uint8_t n)
+{
+    uint8_t ready;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ready = g_scheduler_ready;
+        g_scheduler_ready = 0;
+    }
+
+    if (ready == 0) {
+        scheduler_idle();
+        return;
+    }
+
+    PROFILE_BEGIN();
+    for (uint8_t i = 0 ; i < n ; i++) {
+        if (ready & (uint8_t)(1U << i)) {
+            tasks[i]();
+        }
+    }
+    PROFILE_END(PROFILE_PASS);
+}
+
+
+
+#endif // SCHEDULER_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,397 @@
+//==============================================================================
+// simavr Benchmarks for the Firmware.
+//
+// Runs the real firmware image on a simulated ATmega2560 and reports, as
+// JSON on stdout:
+//
+//   commands   Busy (not sleeping) CPU cycles from the end of a command
+//              line arriving to the end of its response being written,
+//              and cycles to the first response byte.
+//   isr        Cycles from vector dispatch to RETI for the USART RX/UDRE
+//              and TIMER2_COMPA ISRs over the whole run.
+//   max_baud   Highest standard baud rate at which a burst of lines into
+//              each USART comes back complete (USART0: commands answered,
+//              USART1-3: lines forwarded to USART0).
+//
+//   make simavr-bench
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_core.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/avr_uart.h>
+
+
+#define F_CPU 16000000UL
+
+// Give up on a response after 100 ms.
+#define TIMEOUT_CYCLES (F_CPU / 10U)
+
+// Lines sent per USART in the baud rate test.
+#define BURST_LINES 50
+
+
+static avr_t* g_avr;
+
+
+/* Interrupt timing */
+
+// Vector numbers. [DS40002211A, Table 14-1]
+typedef struct {
+    const char* name;
+    uint8_t vector;
+    avr_cycle_count_t entry;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} isr_stats_t;
+
+static isr_stats_t g_isr[] = {
+    {"TIMER2_COMPA_vect", 13},
+    {"USART0_RX_vect", 25},
+    {"USART0_UDRE_vect", 26},
+    {"USART1_RX_vect", 36},
+    {"USART1_UDRE_vect", 37},
+    {"USART2_RX_vect", 51},
+    {"USART2_UDRE_vect", 52},
+    {"USART3_RX_vect", 54},
+    {"USART3_UDRE_vect", 55},
+};
+
+#define ISR_COUNT (sizeof(g_isr) / sizeof(g_isr[0]))
+
+
+// AVR_INT_IRQ_RUNNING is raised on vector dispatch and lowered on RETI.
+static void isr_running(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+    (void)irq;
+    isr_stats_t* const s = param;
+    if (value) {
+        s->entry = g_avr->cycle;
+        return;
+    }
+    const uint32_t t = (uint32_t)(g_avr->cycle - s->entry);
+    if (s->count == 0 || t < s->min) {
+        s->min = t;
+    }
+    if (t > s->max) {
+        s->max = t;
+    }
+    s->sum += t;
+    s->count++;
+}
+
+
+
+/* UART */
+
+typedef struct {
+    char name;
+    avr_irq_t* input;
+    char line[256];                 // Line being received from the AVR.
+    size_t l;
+    uint32_t lines;
+    char last[256];                 // Last complete line.
+    avr_cycle_count_t first_byte;   // Cycle of first byte of last line.
+    avr_cycle_count_t byte_cycles;  // One character time at the baud rate.
+    avr_cycle_count_t next_byte;    // Earliest cycle for the next input.
+} uart_t;
+
+static uart_t g_uart[4] = {{'0'}, {'1'}, {'2'}, {'3'}};
+
+
+static void uart_output(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+    (void)irq;
+    uart_t* const u = param;
+    const char c = (char)value;
+    if (c == '\n') {
+        return;
+    }
+    if (u->l == 0) {
+        u->first_byte = g_avr->cycle;
+    }
+    if (c == '\r') {
+        u->line[u->l] = '\0';
+        memcpy(u->last, u->line, u->l + 1U);
+        u->l = 0;
+        u->lines++;
+        return;
+    }
+    if (u->l < sizeof(u->line) - 1U) {
+        u->line[u->l++] = c;
+    }
+}
+
+
+static void uart_init(uart_t* const u)
+{
+    u->byte_cycles = 10U * F_CPU / 38400U;
+
+    // Don't echo to the simulator's stdout.
+    uint32_t flags = 0;
+    avr_ioctl(g_avr, AVR_IOCTL_UART_GET_FLAGS(u->name), &flags);
+    flags &= ~AVR_UART_FLAG_STDIO;
+    avr_ioctl(g_avr, AVR_IOCTL_UART_SET_FLAGS(u->name), &flags);
+
+    u->input = avr_io_getirq(g_avr, AVR_IOCTL_UART_GETIRQ(u->name),
+                             UART_IRQ_INPUT);
+    avr_irq_register_notify(avr_io_getirq(g_avr,
+                                          AVR_IOCTL_UART_GETIRQ(u->name),
+                                          UART_IRQ_OUTPUT),
+                            uart_output, u);
+}
+
+
+static void run(void);
+
+
+// Send characters no faster than the line would carry them, running the
+// firmware in between, so simavr's UART input FIFO never overflows.
+static void uart_send(uart_t* const u, const char* p)
+{
+    while (*p) {
+        while (g_avr->cycle < u->next_byte) {
+            run();
+        }
+        avr_raise_irq(u->input, (uint8_t)*p++);
+        u->next_byte = g_avr->cycle + u->byte_cycles;
+    }
+}
+
+
+// Write an I/O register as an OUT or STS instruction would: through the
+// peripheral's write callback, so the UART recomputes its timing.
+static void io_write(const uint16_t addr, const uint8_t v)
+{
+    const avr_io_addr_t io = AVR_DATA_TO_IO(addr);
+    if (g_avr->io[io].w.c) {
+        g_avr->io[io].w.c(g_avr, addr, v, g_avr->io[io].w.param);
+    } else {
+        g_avr->data[addr] = v;
+    }
+}
+
+
+// Set UBRRn and U2Xn for `baud`. UCSRnA is read-modify-written so UDREn
+// and the other flags survive; UBRRnL last, as writing it updates the
+// rate. [DS40002211A, 22.3.1, 22.10.2, 22.10.5]
+static void uart_set_baud(const uint8_t n, const uint32_t baud)
+{
+    static const uint16_t ucsra[4] = {0xC0, 0xC8, 0xD0, 0x130};
+    const uint16_t ubrr = (uint16_t)((F_CPU / 8U + baud / 2U) / baud - 1U);
+    io_write(ucsra[n], g_avr->data[ucsra[n]] | (1U << 1));     // U2Xn
+    io_write(ucsra[n] + 5U, (uint8_t)(ubrr >> 8));
+    io_write(ucsra[n] + 4U, (uint8_t)ubrr);
+    g_uart[n].byte_cycles = 10U * F_CPU / baud;
+}
+
+
+
+/* Simulation */
+
+static uint64_t g_busy_cycles = 0;
+
+
+static void run(void)
+{
+    const avr_cycle_count_t c0 = g_avr->cycle;
+    const int sleeping = g_avr->state == cpu_Sleeping;
+    const int state = avr_run(g_avr);
+    if (!sleeping) {
+        g_busy_cycles += g_avr->cycle - c0;
+    }
+    if (state == cpu_Done || state == cpu_Crashed) {
+        fprintf(stderr, "Firmware stopped.\n");
+        exit(1);
+    }
+}
+
+
+static void run_for(const avr_cycle_count_t cycles)
+{
+    const avr_cycle_count_t end = g_avr->cycle + cycles;
+    while (g_avr->cycle < end) {
+        run();
+    }
+}
+
+
+// Run until USART0 has received `target` lines in all, or timeout.
+static int run_until_lines(const uint32_t target)
+{
+    const avr_cycle_count_t end = g_avr->cycle + TIMEOUT_CYCLES;
+    while (g_uart[0].lines < target) {
+        if (g_avr->cycle > end) {
+            return 0;
+        }
+        run();
+    }
+    return 1;
+}
+
+
+
+/* Benchmarks */
+
+static const char* const g_commands[] = {
+    "IB5", "HB5", "LB5", "DB5", "AF0", "MA0", "NA0", "P", "VC", "TX"
+};
+
+#define COMMAND_COUNT (sizeof(g_commands) / sizeof(g_commands[0]))
+
+
+static void bench_commands(void)
+{
+    printf("  \"commands\": {\n");
+    for (size_t i = 0 ; i < COMMAND_COUNT ; i++) {
+        // Time from the end of line arriving in UDR0.
+        const uint32_t rx = g_isr[1].count + strlen(g_commands[i]) + 1U;
+        uart_send(&g_uart[0], g_commands[i]);
+        uart_send(&g_uart[0], "\r");
+        while (g_isr[1].count < rx) {
+            run();
+        }
+        const avr_cycle_count_t start = g_avr->cycle;
+        const uint64_t busy0 = g_busy_cycles;
+        if (!run_until_lines(g_uart[0].lines + 1U)) {
+            fprintf(stderr, "No response to %s\n", g_commands[i]);
+            exit(1);
+        }
+        printf("    \"%s\": {\"busy_cycles\": %llu, "
+                    "\"first_byte_cycles\": %llu}%s\n",
+               g_commands[i],
+               (unsigned long long)(g_busy_cycles - busy0),
+               (unsigned long long)(g_uart[0].first_byte - start),
+               i + 1U < COMMAND_COUNT ? "," : "");
+    }
+    printf("  },\n");
+}
+
+
+// Send a burst of lines on USART `n` at `baud`, return 1 if all are
+// answered (USART0) or forwarded (USART1-3) intact.
+static int burst(const uint8_t n, const uint32_t baud)
+{
+    uart_set_baud(0, n == 0 ? baud : 1000000U);
+    uart_set_baud(n, baud);
+    run_for(F_CPU / 100U);
+
+    char expected[32] = ">HB5";
+    if (n != 0) {
+        snprintf(expected, sizeof(expected), "%c0123456789ABCDEF", '0' + n);
+    }
+
+    // Replies start arriving while the burst is still being sent.
+    const uint32_t target = g_uart[0].lines + BURST_LINES;
+    for (int i = 0 ; i < BURST_LINES ; i++) {
+        uart_send(&g_uart[n], n == 0 ? "HB5\r" : "0123456789ABCDEF\r\n");
+    }
+    return run_until_lines(target)
+        && strcmp(g_uart[0].last, expected) == 0;
+}
+
+
+static void bench_max_baud(void)
+{
+    static const uint32_t rates[] = {
+        38400, 57600, 76800, 115200, 250000, 500000, 1000000
+    };
+    printf("  \"max_baud\": {\n");
+    for (uint8_t n = 0 ; n < 4 ; n++) {
+        uint32_t max = 0;
+        for (size_t i = 0 ; i < sizeof(rates) / sizeof(rates[0]) ; i++) {
+            if (!burst(n, rates[i])) {
+                break;
+            }
+            max = rates[i];
+        }
+        printf("    \"USART%d\": %u%s\n", n, max, n < 3 ? "," : "");
+    }
+    uart_set_baud(0, 38400);
+    printf("  },\n");
+}
+
+
+static void print_isr_stats(void)
+{
+    printf("  \"isr\": {\n");
+    for (size_t i = 0 ; i < ISR_COUNT ; i++) {
+        const isr_stats_t* const s = &g_isr[i];
+        printf("    \"%s\": {\"count\": %u, \"min\": %u, \"max\": %u, "
+                    "\"mean\": %.1f}%s\n",
+               s->name, s->count, s->min, s->max,
+               s->count ? (double)s->sum / s->count : 0.0,
+               i + 1U < ISR_COUNT ? "," : "");
+    }
+    printf("  }\n");
+}
+
+
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s firmware.elf\n", argv[0]);
+        return 1;
+    }
+
+    elf_firmware_t firmware = {{0}};
+    if (elf_read_firmware(argv[1], &firmware) != 0) {
+        fprintf(stderr, "Can't read %s\n", argv[1]);
+        return 1;
+    }
+
+    g_avr = avr_make_mcu_by_name("atmega2560");
+    if (!g_avr) {
+        fprintf(stderr, "simavr has no atmega2560 core\n");
+        return 1;
+    }
+    avr_init(g_avr);
+    g_avr->frequency = F_CPU;
+    avr_load_firmware(g_avr, &firmware);
+
+    for (size_t i = 0 ; i < ISR_COUNT ; i++) {
+        avr_irq_t* const irq = avr_get_interrupt_irq(g_avr, g_isr[i].vector);
+        avr_irq_register_notify(irq + AVR_INT_IRQ_RUNNING,
+                                isr_running, &g_isr[i]);
+    }
+    for (uint8_t n = 0 ; n < 4 ; n++) {
+        uart_init(&g_uart[n]);
+    }
+
+    // Wait for the ">Z" banner.
+    if (!run_until_lines(2)) {
+        fprintf(stderr, "No banner from firmware\n");
+        return 1;
+    }
+
+    printf("{\n");
+    printf("  \"firmware\": \"%s\",\n", argv[1]);
+    printf("  \"f_cpu\": %lu,\n", F_CPU);
+    bench_commands();
+    bench_max_baud();
+    print_isr_stats();
+    printf("}\n");
+
+    return 0;
+}
+
+
+
+//==============================================================================
+// End of file.
+//==============================================================================
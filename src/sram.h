@@ -0,0 +1,86 @@
+//==============================================================================
+// SRAM Usage.
+//
+// The SRAM between the end of the static data (.data, .bss, .noinit) and
+// the top of the stack is painted with SRAM_PAINT before the C runtime
+// starts. The stack's high-water mark is where the paint stops. There is
+// no heap (no malloc), so all of that space belongs to the stack.
+//
+// "make memory-map" lists the largest static objects of a build.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef SRAM_H_INCLUDED
+#define SRAM_H_INCLUDED
+
+
+#define SRAM_PAINT 0xC5U
+
+
+#ifdef __AVR__
+
+extern uint8_t __data_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+
+
+// Runs from .init1, before the stack or __zero_reg__ are set up, so it
+// is naked and uses only Z and r24, r25.
+void sram_paint(void) __attribute__ ((naked))
+                      __attribute__ ((used))
+                      __attribute__ ((section (".init1")));
+void sram_paint(void)
+{
+    asm volatile("    ldi r30, lo8(_end)      \n"
+                 "    ldi r31, hi8(_end)      \n"
+                 "    ldi r24, %0             \n"
+                 "    ldi r25, hi8(__stack)   \n"
+                 "    rjmp 2f                 \n"
+                 "1:  st Z+, r24              \n"
+                 "2:  cpi r30, lo8(__stack)   \n"
+                 "    cpc r31, r25            \n"
+                 "    brlo 1b                 \n"
+                 "    breq 1b                 \n"
+                 : : "i" (SRAM_PAINT));
+}
+
+
+static uint16_t sram_static_size(void)
+{
+    return (uint16_t)(&_end - &__data_start);
+}
+
+
+static uint16_t sram_stack_size(void)
+{
+    return (uint16_t)(&__stack - &_end + 1);
+}
+
+
+// Bytes of stack never used since reset.
+static uint16_t sram_stack_unused(void)
+{
+    const uint8_t* p = &_end;
+    while (p <= &__stack && *p == SRAM_PAINT) {
+        p++;
+    }
+    return (uint16_t)(p - &_end);
+}
+
+#else
+
+// Host build: no memory map.
+static uint16_t sram_static_size(void) { return 0; }
+static uint16_t sram_stack_size(void) { return 0; }
+static uint16_t sram_stack_unused(void) { return 0; }
+
+#endif
+
+
+
+#endif // SRAM_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
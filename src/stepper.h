@@ -0,0 +1,506 @@
+//==============================================================================
+// Step/Direction Motion Generator.
+//
+// Two stepper axes driven from Timer/Counter 4, free running at 2 MHz
+// (0.5 us resolution). Axis 0 steps on OC4A = PH3 (Arduino pin 6), axis 1
+// on OC4B = PH4 (Arduino pin 7). The compare unit sets the step pin on the
+// match, so step edges are exact to the timer tick whatever the interrupt
+// latency. The compare ISR then counts the step, ends the pulse and loads
+// the next match. The direction pin of each axis is configurable.
+//
+// Moves are queued per axis and run one after another, each a trapezoid
+// from rest to rest: accelerate from sqrt(2a) steps/s, cruise at the move's
+// rate, decelerate to arrive on the last step. The speed is updated once
+// per ms from the OC4C compare ISR. "!K<axis><position:8>" is sent when a
+// move ends.
+//
+// The planner runs with interrupts enabled apart from a few short atomic
+// copies, so it holds off a step ISR by at most a few us. As step edges
+// come from the compare unit, such latency, like that of any other ISR or
+// atomic block in the firmware, only stretches the step pulse; a step is
+// only late if its ISR is held off for longer than the step interval
+// (25 us at 40 kHz), and it is then moved STEPPER_LATE_TICKS past the ISR.
+//
+// Step rates are 32 to STEPPER_MAX_RATE steps/s per axis. Step pulses are
+// high for the step ISR's run time, 2-4 us.
+//
+// CPU budget, estimated by hand rather than measured (measure it on the
+// target with a -DPROFILE build: "QR" probes isr_stepper and
+// isr_stepper_plan). A step ISR is about 100 cycles with entry and exit,
+// so two axes at 40 kHz take about 8M cycles/s, half the CPU. The planner
+// does one 32-bit division and three 32-bit multiplies per running axis,
+// about 1000 cycles, so up to 2000 cycles per ms, 1/8 of the CPU. Other
+// work gets the remaining ~40 % with both axes at full rate.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//
+// DS40002211A: https://ww1.microchip.com/downloads/en/DeviceDoc/
+//              ATmega640-1280-1281-2560-2561-Datasheet-DS40002211A.pdf
+//==============================================================================
+
+#ifndef STEPPER_H_INCLUDED
+#define STEPPER_H_INCLUDED
+
+
+#define STEPPER_AXES 2
+
+#ifndef STEPPER_QUEUE_SIZE
+#define STEPPER_QUEUE_SIZE 8
+#endif
+
+#define STEPPER_TIMER_HZ 2000000UL
+#define STEPPER_PLAN_TICKS 2000U                // 1 ms.
+#define STEPPER_MIN_RATE 32U                    // Interval fits 16 bits.
+#define STEPPER_MAX_RATE 40000U
+#define STEPPER_MAX_ACCEL 0xFFFFFUL
+
+// Shortest time from loading a compare to its match (ticks).
+#define STEPPER_LATE_TICKS 8
+
+// Speeds are in 1/256 steps/s.
+#define STEPPER_SPEED(rate) ((uint32_t)(rate) << 8U)
+
+
+// Move, as queued.
+typedef struct {
+    uint32_t steps;
+    bool reverse;
+    uint32_t v_start;               // 1/256 steps/s.
+    uint32_t v_max;
+    uint32_t dv;                    // Speed change per ms.
+    uint32_t accel;                 // steps/s².
+    uint32_t v_start_2;             // (v_start in steps/s)².
+    uint32_t brake_steps;           // Stopping distance from v_max, + 1.
+} stepper_move_t;
+
+
+typedef struct {
+    volatile int32_t position;
+    volatile uint32_t remaining;    // Steps left in the running move.
+    volatile uint16_t interval;     // Ticks between steps.
+    volatile int8_t step;           // +1 or -1.
+    volatile bool running;
+    volatile bool done;             // Move ended, not yet reported.
+    int32_t done_position;
+    uint32_t v;
+    stepper_move_t move;
+    stepper_move_t queue[STEPPER_QUEUE_SIZE];
+    volatile uint8_t queue_in;
+    volatile uint8_t queue_out;
+    volatile uint8_t* dir_port;
+    uint8_t dir_mask;
+} stepper_axis_t;
+
+
+static stepper_axis_t g_stepper[STEPPER_AXES];
+static bool g_stepper_enabled = false;
+
+
+
+/* Step ISRs */
+
+// Each match set OC4x (a step). Count it, then clear OC4x with a forced
+// compare in clear mode and go back to set mode for the next match, or
+// after the last step disconnect OC4x (PORTH bit is low).
+// [DS40002211A, Table 17-3]
+#define STEPPER_ISR(axis, X) \
+ISR(TIMER4_COMP##X##_vect) \
+{ \
+    PROFILE_BEGIN(); \
+    stepper_axis_t* const a = &g_stepper[axis]; \
+    a->position += a->step; \
+    if (--a->remaining == 0) { \
+        TIMSK4 &= (uint8_t)~bit1(OCIE4##X); \
+        TCCR4A &= (uint8_t)~bit2(COM4##X##1, COM4##X##0); \
+        a->done_position = a->position; \
+        a->running = false; \
+        a->done = true; \
+    } else { \
+        uint16_t next = OCR4##X + a->interval; \
+        const uint16_t now = TCNT4; \
+        if ((int16_t)(next - now) < STEPPER_LATE_TICKS) { \
+            next = now + STEPPER_LATE_TICKS; \
+        } \
+        OCR4##X = next; \
+        TCCR4A &= (uint8_t)~bit1(COM4##X##0); \
+        TCCR4C = bit1(FOC4##X); \
+        TCCR4A |= bit1(COM4##X##0); \
+    } \
+    PROFILE_END(PROFILE_ISR_STEPPER); \
+}
+
+STEPPER_ISR(0, A)
+STEPPER_ISR(1, B)
+
+
+
+/* Planner */
+
+static uint16_t stepper_interval(const uint32_t v)
+{
+    return (uint16_t)((STEPPER_TIMER_HZ << 8U) / v);
+}
+
+
+// Start the next queued move on an idle axis. Interrupts are enabled.
+// The direction pin is set at least one step interval before the step.
+static void stepper_start_next(const uint8_t axis, stepper_axis_t* const a)
+{
+    if (a->done || a->queue_in == a->queue_out) {
+        return;
+    }
+    a->move = a->queue[a->queue_out];
+    a->queue_out = (uint8_t)((a->queue_out + 1U) % STEPPER_QUEUE_SIZE);
+
+    a->v = a->move.v_start;
+    const uint16_t interval = stepper_interval(a->v);
+
+    // The direction port is shared with the GPIO commands and the other
+    // output ISRs, so it is updated with interrupts disabled.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (a->move.reverse) {
+            *a->dir_port |= a->dir_mask;
+        } else {
+            *a->dir_port &= (uint8_t)~a->dir_mask;
+        }
+        a->step = a->move.reverse ? -1 : 1;
+        a->remaining = a->move.steps;
+        a->interval = interval;
+        const uint16_t first = TCNT4 + interval;
+        if (axis == 0) {
+            OCR4A = first;
+            TCCR4A |= bit2(COM4A1, COM4A0);
+            TIFR4 = bit1(OCF4A);
+            TIMSK4 |= bit1(OCIE4A);
+        } else {
+            OCR4B = first;
+            TCCR4A |= bit2(COM4B1, COM4B0);
+            TIFR4 = bit1(OCF4B);
+            TIMSK4 |= bit1(OCIE4B);
+        }
+        a->running = true;
+    }
+}
+
+
+// (v in steps/s)² - (v_start in steps/s)², v is at most
+// STEPPER_MAX_RATE steps/s so this fits 32 bits.
+static uint32_t stepper_v2(const stepper_move_t* const m, const uint32_t v)
+{
+    const uint32_t vs = v >> 8U;
+    return vs * vs - m->v_start_2;
+}
+
+
+// Steps needed to slow from speed v to the move's start speed:
+// (v² - v_start²) / 2a.
+static uint32_t stepper_stop_steps(const stepper_move_t* const m,
+                                   const uint32_t v)
+{
+    return stepper_v2(m, v) / (2U * m->accel);
+}
+
+
+// Once per ms: accelerate, cruise or decelerate. Deceleration starts
+// when the steps left after the next ms are no more than the stopping
+// distance, 2a × left <= v² - v_start². Only compared when left is within
+// the move's longest stopping distance, so 2a × left fits 32 bits.
+static void stepper_plan(const uint8_t axis, stepper_axis_t* const a)
+{
+    if (!a->running) {
+        stepper_start_next(axis, a);
+        return;
+    }
+
+    uint32_t remaining;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        remaining = a->remaining;
+    }
+    const uint32_t next_ms = ((a->v >> 8U) * 131U) >> 17U;     // v / 1000
+    const uint32_t left = remaining > next_ms ? remaining - next_ms : 0;
+
+    uint32_t v = a->v;
+    if (left <= a->move.brake_steps
+    &&  2U * a->move.accel * left <= stepper_v2(&a->move, v)) {
+        v = v > a->move.v_start + a->move.dv ? v - a->move.dv
+                                             : a->move.v_start;
+    } else if (v < a->move.v_max) {
+        v = v + a->move.dv < a->move.v_max ? v + a->move.dv : a->move.v_max;
+    }
+    a->v = v;
+
+    const uint16_t interval = stepper_interval(v);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        a->interval = interval;
+    }
+}
+
+
+// Division heavy, so step ISRs may interrupt it.
+ISR(TIMER4_COMPC_vect, ISR_NOBLOCK)
+{
+    PROFILE_BEGIN();
+    OCR4C += STEPPER_PLAN_TICKS;
+    for (uint8_t axis = 0 ; axis < STEPPER_AXES ; axis++) {
+        stepper_plan(axis, &g_stepper[axis]);
+    }
+    PROFILE_END(PROFILE_ISR_STEPPER_PLAN);
+}
+
+
+
+/* Control */
+
+// Normal mode, clk/8, planner on OC4C.
+// [DS40002211A, Table 17-2, Table 17-6]
+static void stepper_timer_start(void)
+{
+    timer_claim(4, 'K');
+    timer_power_on(4);
+    TCCR4A = 0;
+    TCNT4 = 0;
+    OCR4C = STEPPER_PLAN_TICKS;
+    TIFR4 = bit4(OCF4A, OCF4B, OCF4C, TOV4);
+    TIMSK4 = bit1(OCIE4C);
+    TCCR4B = bit1(CS41);
+    g_stepper_enabled = true;
+}
+
+
+static void stepper_timer_stop(void)
+{
+    TIMSK4 = 0;
+    TCCR4B = 0;
+    TCCR4A = 0;
+    g_stepper_enabled = false;
+    timer_release(4, 'K');
+}
+
+
+static bool stepper_is_busy(const stepper_axis_t* const a)
+{
+    return a->running || a->done || a->queue_in != a->queue_out;
+}
+
+
+static void stepper_configure(const uint8_t axis, const uint8_t port,
+                              const uint8_t pin)
+{
+    stepper_axis_t* const a = &g_stepper[axis];
+    assert(!stepper_is_busy(a), "Stepper Busy!");
+    assert(pin >= '0' && pin <= '7', "Bad GPIO Pin!");
+
+    a->dir_port = gpio_port_register(port);
+    a->dir_mask = bit1(pin - (uint8_t)'0');
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *a->dir_port &= (uint8_t)~a->dir_mask;
+        *gpio_ddr_register(port) |= a->dir_mask;
+
+        PORTH &= (uint8_t)~bit1(3U + axis);
+        DDRH |= bit1(3U + axis);
+    }
+}
+
+
+static uint32_t stepper_isqrt(uint32_t x)
+{
+    uint32_t r = 0;
+    for (uint32_t b = 1UL << 30U ; b != 0 ; b >>= 2U) {
+        if (x >= r + b) {
+            x -= r + b;
+            r = (r >> 1U) + b;
+        } else {
+            r >>= 1U;
+        }
+    }
+    return r;
+}
+
+
+static void stepper_queue_move(const uint8_t axis, const int32_t steps,
+                               const uint16_t rate, const uint32_t accel)
+{
+    stepper_axis_t* const a = &g_stepper[axis];
+    assert(a->dir_port != NULL, "Stepper Not Configured!");
+    assert(rate >= STEPPER_MIN_RATE && rate <= STEPPER_MAX_RATE,
+           "Bad Stepper Rate!");
+    assert(accel != 0 && accel <= STEPPER_MAX_ACCEL, "Bad Stepper Accel!");
+
+    const uint8_t next = (uint8_t)((a->queue_in + 1U) % STEPPER_QUEUE_SIZE);
+    assert(next != a->queue_out, "Stepper Queue Full!");
+    if (steps == 0) {
+        return;
+    }
+
+    // Speed after one step from rest.
+    uint32_t start = stepper_isqrt(2U * accel);
+    start = start < STEPPER_MIN_RATE ? STEPPER_MIN_RATE
+          : start > rate ? rate : start;
+
+    stepper_move_t* const m = &a->queue[a->queue_in];
+    m->reverse = steps < 0;
+    m->steps = steps < 0 ? -(uint32_t)steps : (uint32_t)steps;
+    m->v_start = STEPPER_SPEED(start);
+    m->v_max = STEPPER_SPEED(rate);
+    m->dv = (STEPPER_SPEED(accel) + 500U) / 1000U;
+    m->accel = accel;
+    m->v_start_2 = start * start;
+    m->brake_steps = stepper_stop_steps(m, m->v_max) + 1U;
+    a->queue_in = next;
+
+    if (!g_stepper_enabled) {
+        stepper_timer_start();
+    }
+}
+
+
+// Drop queued moves and decelerate to a stop. With the queue empty no
+// other move can start, so the running move's stopping distance can be
+// worked out with interrupts enabled.
+static void stepper_stop(const uint8_t axis)
+{
+    stepper_axis_t* const a = &g_stepper[axis];
+    bool running;
+    uint32_t v;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        a->queue_in = a->queue_out;
+        running = a->running;
+        v = a->v;
+    }
+    if (!running) {
+        return;
+    }
+    const uint32_t steps = stepper_stop_steps(&a->move, v) + 1U;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (a->running && a->remaining > steps) {
+            a->remaining = steps;
+        }
+    }
+}
+
+
+// Stop both axes now, steps may be lost.
+static void stepper_abort(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        TIMSK4 &= (uint8_t)~bit2(OCIE4A, OCIE4B);
+        TCCR4A &= (uint8_t)~bit4(COM4A1, COM4A0, COM4B1, COM4B0);
+        for (uint8_t axis = 0 ; axis < STEPPER_AXES ; axis++) {
+            stepper_axis_t* const a = &g_stepper[axis];
+            a->queue_in = a->queue_out;
+            if (a->running) {
+                a->running = false;
+                a->done_position = a->position;
+                a->done = true;
+            }
+        }
+    }
+}
+
+
+// Send "!K<axis><position:8>" for each finished move, stop the timer
+// when both axes are idle.
+static void stepper_poll(void)
+{
+    if (!g_stepper_enabled) {
+        return;
+    }
+    bool busy = false;
+    for (uint8_t axis = 0 ; axis < STEPPER_AXES ; axis++) {
+        stepper_axis_t* const a = &g_stepper[axis];
+        if (a->done) {
+            print_c('!');
+            print_c('K');
+            print_hex_digit(axis);
+            print_hex32((uint32_t)a->done_position);
+            print_end_of_line();
+            a->done = false;
+        }
+        busy |= stepper_is_busy(a);
+    }
+    if (!busy) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            if (!stepper_is_busy(&g_stepper[0])
+            &&  !stepper_is_busy(&g_stepper[1])) {
+                stepper_timer_stop();
+            }
+        }
+    }
+}
+
+
+
+/* Commands */
+
+static uint8_t stepper_axis(const uint8_t c)
+{
+    const uint8_t axis = c - (uint8_t)'0';
+    assert(axis < STEPPER_AXES, "Bad Stepper Axis!");
+    return axis;
+}
+
+
+// KC<axis><port><pin>                  Set direction pin, high = reverse.
+//                                      Step pin is PH3 (axis 0) or PH4.
+// KM<axis><steps:8><rate:4><accel:6>   Queue move of <steps> (signed)
+//                                      at up to <rate> steps/s with
+//                                      <accel> steps/s².
+// KP<axis><position:8>                 Set position (idle axis).
+// KS<axis>                             Decelerate to a stop, drop queue.
+// KX                                   Stop both axes now, drop queues.
+// KQ<axis>                             Query.
+//
+// KQ responds with <running:2><position:8><moves queued:2>.
+static void stepper_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 2, "Short Stepper Command!");
+
+    switch(p[1]) {
+        case 'C': assert(l == 5, "Bad Stepper Config!");
+                  stepper_configure(stepper_axis(p[2]), p[3], p[4]);
+                  break;
+        case 'M': assert(l == 21, "Bad Stepper Move!");
+                  stepper_queue_move(stepper_axis(p[2]),
+                                     (int32_t)parse_hex(p + 3, 8),
+                                     (uint16_t)parse_hex(p + 11, 4),
+                                     parse_hex(p + 15, 6));
+                  break;
+        case 'P': {
+            assert(l == 11, "Bad Stepper Position!");
+            stepper_axis_t* const a = &g_stepper[stepper_axis(p[2])];
+            assert(!a->running, "Stepper Busy!");
+            a->position = (int32_t)parse_hex(p + 3, 8);
+            break;
+        }
+        case 'S': assert(l == 3, "Bad Stepper Command!");
+                  stepper_stop(stepper_axis(p[2]));
+                  break;
+        case 'X': stepper_abort(); break;
+        case 'Q': assert(l == 3, "Bad Stepper Command!");
+                  break;
+        default: assert(0, "Bad Stepper Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    if (p[1] == 'Q') {
+        const stepper_axis_t* const a = &g_stepper[stepper_axis(p[2])];
+        int32_t position;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            position = a->position;
+        }
+        print_hex(a->running);
+        print_hex32((uint32_t)position);
+        print_hex((uint8_t)((a->queue_in + STEPPER_QUEUE_SIZE - a->queue_out)
+                            % STEPPER_QUEUE_SIZE));
+    }
+    print_end_of_line();
+}
+
+
+
+#endif // STEPPER_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,232 @@
+//==============================================================================
+// Compressed ADC Telemetry Stream.
+//
+// Samples a set of background-scanned ADC channels every `period` ms and
+// sends them in blocks of `block` sample sets, one "~" line per block.
+//
+// Each line is a bit stream, MSB first, packed 6 bits per character as
+// '0' + (0..63) (printable, safe for the host's canonical tty mode):
+//
+//   time:32        ms_clock32() of the first sample set.
+//   count:8        Number of sample sets in the line.
+//   Keyframe:      One raw 10-bit value per channel (low channel first).
+//   count - 1 ×    Per channel, raw 10-bit value, or for delta channels
+//                  the zig-zag encoded difference from the previous value
+//                  as a varint of 4-bit groups (continue:1, bits:3),
+//                  least significant group first.
+//
+// The last character is zero padded. A sample that can't be taken on time
+// ends the block early, so every line starts with a keyframe and a
+// timestamp and decodes on its own.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef TELEMETRY_H_INCLUDED
+#define TELEMETRY_H_INCLUDED
+
+
+// Sample values buffered per block.
+#ifndef TELEMETRY_BUFFER_SIZE
+#define TELEMETRY_BUFFER_SIZE 64U
+#endif
+
+
+static uint16_t g_telemetry_mask = 0;           // Channels, 0 = stopped.
+static uint16_t g_telemetry_delta = 0;          // Delta coded channels.
+static uint8_t g_telemetry_channels = 0;
+static uint16_t g_telemetry_period = 0;
+static uint8_t g_telemetry_block = 0;           // Sample sets per line.
+static uint8_t g_telemetry_count = 0;           // Sample sets buffered.
+static uint32_t g_telemetry_time = 0;           // Time of first set.
+static uint32_t g_telemetry_next = 0;           // Time of next set.
+static uint16_t g_telemetry_buffer[TELEMETRY_BUFFER_SIZE];
+
+
+/* Bit stream */
+
+static uint16_t g_telemetry_bits = 0;
+static uint8_t g_telemetry_nbits = 0;
+
+
+static void telemetry_put_bits(const uint16_t value, const uint8_t n)
+{
+    for (uint8_t i = n ; i > 0 ; i--) {
+        g_telemetry_bits = (g_telemetry_bits << 1U)
+                         | ((value >> (i - 1U)) & 1U);
+        if (++g_telemetry_nbits == 6U) {
+            print_c('0' + (uint8_t)g_telemetry_bits);
+            g_telemetry_bits = 0;
+            g_telemetry_nbits = 0;
+        }
+    }
+}
+
+
+static void telemetry_flush_bits(void)
+{
+    if (g_telemetry_nbits != 0) {
+        telemetry_put_bits(0, 6U - g_telemetry_nbits);
+    }
+}
+
+
+static void telemetry_put_varint(uint16_t value)
+{
+    do {
+        const uint8_t more = value > 7U;
+        telemetry_put_bits((uint16_t)(more << 3U) | (value & 7U), 4);
+        value >>= 3U;
+    } while (value != 0);
+}
+
+
+static uint16_t zigzag16(const int16_t x)
+{
+    return (uint16_t)((uint16_t)x << 1U) ^ (uint16_t)(x >> 15);
+}
+
+
+
+/* Stream */
+
+static void telemetry_send_block(void)
+{
+    if (g_telemetry_count == 0) {
+        return;
+    }
+
+    print_c('~');
+    telemetry_put_bits(g_telemetry_time >> 16U, 16);
+    telemetry_put_bits(g_telemetry_time & 0xFFFFU, 16);
+    telemetry_put_bits(g_telemetry_count, 8);
+
+    const uint16_t* v = g_telemetry_buffer;
+    for (uint8_t set = 0 ; set < g_telemetry_count ; set++) {
+        for (uint8_t channel = 0 ; channel < 16 ; channel++) {
+            const uint16_t bit = adc_channel_bit(channel);
+            if ((g_telemetry_mask & bit) == 0) {
+                continue;
+            }
+            if (set == 0 || (g_telemetry_delta & bit) == 0) {
+                telemetry_put_bits(*v, 10);
+            } else {
+                const uint16_t previous = *(v - g_telemetry_channels);
+                telemetry_put_varint(zigzag16((int16_t)(*v - previous)));
+            }
+            v++;
+        }
+    }
+    telemetry_flush_bits();
+    print_end_of_line();
+
+    g_telemetry_count = 0;
+}
+
+
+static void telemetry_poll(void)
+{
+    if (g_telemetry_mask == 0) {
+        return;
+    }
+
+    const uint32_t now = ms_clock32();
+    if ((int32_t)(now - g_telemetry_next) < 0) {
+        return;
+    }
+
+    // Late by more than a period: restart the block (new keyframe).
+    if ((uint32_t)(now - g_telemetry_next) >= g_telemetry_period) {
+        telemetry_send_block();
+        g_telemetry_next = now;
+    }
+
+    if (g_telemetry_count == 0) {
+        g_telemetry_time = g_telemetry_next;
+    }
+    uint16_t* v = g_telemetry_buffer
+                + (uint16_t)g_telemetry_count * g_telemetry_channels;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t channel = 0 ; channel < 16 ; channel++) {
+            if (g_telemetry_mask & adc_channel_bit(channel)) {
+                *v++ = g_adc_value[channel];
+            }
+        }
+    }
+    g_telemetry_next += g_telemetry_period;
+
+    if (++g_telemetry_count == g_telemetry_block) {
+        telemetry_send_block();
+    }
+}
+
+
+static void telemetry_stop(void)
+{
+    telemetry_send_block();
+    g_telemetry_mask = 0;
+    adc_scan(ADC_SCAN_TELEMETRY, 0);
+}
+
+
+static void telemetry_start(const uint16_t mask, const uint16_t period,
+                            const uint8_t block, const uint16_t delta)
+{
+    telemetry_stop();
+
+    uint8_t channels = 0;
+    for (uint8_t channel = 0 ; channel < 16 ; channel++) {
+        if (mask & adc_channel_bit(channel)) {
+            channels++;
+        }
+    }
+    assert(channels != 0 && period != 0 && block != 0, "Bad Telemetry!");
+    assert((uint16_t)channels * block <= TELEMETRY_BUFFER_SIZE,
+           "Telemetry Block Too Long!");
+
+    g_telemetry_channels = channels;
+    g_telemetry_period = period;
+    g_telemetry_block = block;
+    g_telemetry_delta = delta;
+    g_telemetry_count = 0;
+    g_telemetry_next = ms_clock32() + period;
+    adc_scan(ADC_SCAN_TELEMETRY, mask);
+    g_telemetry_mask = mask;
+}
+
+
+
+/* Commands */
+
+// TS<channels:4><period:4><block:2><delta:4>
+//          Stream ADC channels (bit mask, bit 0 = F0, bit 15 = K7) every
+//          <period> ms, <block> sets per line, <delta> channels (bit mask)
+//          delta coded.
+// TX       Stop (sends the partial block).
+static void telemetry_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 2, "Short Telemetry Command!");
+
+    switch(p[1]) {
+        case 'S': assert(l == 16, "Bad Telemetry!");
+                  telemetry_start((uint16_t)parse_hex(p + 2, 4),
+                                  (uint16_t)parse_hex(p + 6, 4),
+                                  (uint8_t)parse_hex(p + 10, 2),
+                                  (uint16_t)parse_hex(p + 12, 4));
+                  break;
+        case 'X': telemetry_stop(); break;
+        default: assert(0, "Bad Telemetry Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    print_end_of_line();
+}
+
+
+
+#endif // TELEMETRY_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
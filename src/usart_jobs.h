@@ -0,0 +1,221 @@
+//==============================================================================
+// Periodic USART Polling Jobs.
+//
+// "Every N ms send this query to USARTn, and report the reply line."
+//
+// Jobs are started from the millisecond tick, so poll jitter is that of
+// the tick rather than of the host. The first line received on the USART
+// after a query is the job's reply. It is reported as
+// "!J<job><time:8><reply>" (time of the query in ms) either every time or
+// only when it differs from the previous reply. Other lines are forwarded
+// to the host as usual.
+//
+// Jobs sharing a USART take turns: a job that falls due while another
+// job on the same USART is waiting for its reply is sent after that reply
+// arrives or after JOB_REPLY_TIMEOUT_MS.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef USART_JOBS_H_INCLUDED
+#define USART_JOBS_H_INCLUDED
+
+
+#ifndef JOB_COUNT
+#define JOB_COUNT 4
+#endif
+
+#ifndef JOB_QUERY_SIZE
+#define JOB_QUERY_SIZE 24
+#endif
+
+#define JOB_REPLY_TIMEOUT_MS 100U
+
+#define JOB_NONE 0xFFU
+
+
+typedef struct {
+    uint8_t usart;                  // '1'-'3' (0 = job unused).
+    bool always;                    // Report unchanged replies.
+    uint16_t period;                // ms.
+    uint32_t next_time;
+    uint32_t query_time;
+    uint32_t reply_hash;            // FNV-1a of the last reply.
+    bool replied;                   // reply_hash is valid.
+    uint8_t l;
+    uint8_t query[JOB_QUERY_SIZE];
+} usart_job_t;
+
+
+static usart_job_t g_job[JOB_COUNT];
+
+// Job waiting for a reply, per USART.
+static uint8_t g_job_waiting[3] = {JOB_NONE, JOB_NONE, JOB_NONE};
+
+
+static uint32_t job_hash(const uint8_t* const p, const uint8_t l)
+{
+    uint32_t h = 2166136261UL;
+    for (uint8_t i = 0 ; i < l ; i++) {
+        h = (h ^ p[i]) * 16777619UL;
+    }
+    return h;
+}
+
+
+static void job_send(const uint8_t usart, const uint8_t c)
+{
+    switch(usart) {
+        case '1': usart1_tx(c); break;
+        case '2': usart2_tx(c); break;
+        case '3': usart3_tx(c); break;
+    }
+}
+
+
+static void job_start(const uint8_t i, usart_job_t* const j,
+                      const uint32_t now)
+{
+    for (uint8_t k = 0 ; k < j->l ; k++) {
+        job_send(j->usart, j->query[k]);
+    }
+    job_send(j->usart, '\r');
+    job_send(j->usart, '\n');
+    j->query_time = now;
+    g_job_waiting[j->usart - (uint8_t)'1'] = i;
+}
+
+
+// Once per millisecond: expire unanswered queries, send due queries.
+static void usart_jobs_poll(void)
+{
+    const uint32_t now = ms_clock32();
+
+    for (uint8_t u = 0 ; u < 3 ; u++) {
+        const uint8_t i = g_job_waiting[u];
+        if (i != JOB_NONE
+        &&  now - g_job[i].query_time >= JOB_REPLY_TIMEOUT_MS) {
+            g_job_waiting[u] = JOB_NONE;
+        }
+    }
+
+    for (uint8_t i = 0 ; i < JOB_COUNT ; i++) {
+        usart_job_t* const j = &g_job[i];
+        if (j->usart == 0
+        ||  (int32_t)(now - j->next_time) < 0
+        ||  g_job_waiting[j->usart - (uint8_t)'1'] != JOB_NONE) {
+            continue;
+        }
+        job_start(i, j, now);
+
+        // Keep to the period, unless more than a period late.
+        j->next_time += j->period;
+        if ((int32_t)(now - j->next_time) >= 0) {
+            j->next_time = now + j->period;
+        }
+    }
+}
+
+
+// Line received on USART '1'-'3'. Returns true if it was a job's reply.
+static bool usart_jobs_reply(const uint8_t usart,
+                             const uint8_t* const p, const uint8_t l)
+{
+    uint8_t* const waiting = &g_job_waiting[usart - (uint8_t)'1'];
+    const uint8_t i = *waiting;
+    if (i == JOB_NONE) {
+        return false;
+    }
+    *waiting = JOB_NONE;
+
+    usart_job_t* const j = &g_job[i];
+    const uint32_t hash = job_hash(p, l);
+    if (j->always || !j->replied || hash != j->reply_hash) {
+        print_c('!');
+        print_c('J');
+        print_hex_digit(i);
+        print_hex32(j->query_time);
+        print_n(p, l);
+        print_end_of_line();
+    }
+    j->reply_hash = hash;
+    j->replied = true;
+    return true;
+}
+
+
+static void usart_job_clear(const uint8_t i)
+{
+    usart_job_t* const j = &g_job[i];
+    if (j->usart != 0 && g_job_waiting[j->usart - (uint8_t)'1'] == i) {
+        g_job_waiting[j->usart - (uint8_t)'1'] = JOB_NONE;
+    }
+    j->usart = 0;
+}
+
+
+
+/* Commands */
+
+static uint8_t job_index(const uint8_t c)
+{
+    const uint8_t i = c - (uint8_t)'0';
+    assert(i < JOB_COUNT, "Bad Job Number!");
+    return i;
+}
+
+
+// JS<job:1><usart:1><period:4><mode><query...>     Set job, mode C = report
+//                                                  changed replies, A = all.
+//                                                  Query is sent with CR LF.
+// JX<job:1>                                        Clear job.
+// JC                                               Clear all jobs.
+static void usart_jobs_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 2, "Short Job Command!");
+
+    switch(p[1]) {
+        case 'S': {
+            assert(l >= 10 && l - 9U <= JOB_QUERY_SIZE, "Bad Job!");
+            assert(p[3] >= '1' && p[3] <= '3', "Bad USART!");
+            assert(fifo_arena_usart_is_used(p[3]), "USART Not Used!");
+            assert(p[8] == 'C' || p[8] == 'A', "Bad Job Mode!");
+            const uint8_t i = job_index(p[2]);
+            const uint16_t period = (uint16_t)parse_hex(p + 4, 4);
+            assert(period != 0, "Bad Job Period!");
+
+            usart_job_clear(i);
+            usart_job_t* const j = &g_job[i];
+            j->period = period;
+            j->always = p[8] == 'A';
+            j->replied = false;
+            j->l = l - 9U;
+            for (uint8_t k = 0 ; k < j->l ; k++) {
+                j->query[k] = p[9 + k];
+            }
+            j->next_time = ms_clock32();
+            j->usart = p[3];
+            break;
+        }
+        case 'X': assert(l == 3, "Bad Job Command!");
+                  usart_job_clear(job_index(p[2]));
+                  break;
+        case 'C': for (uint8_t i = 0 ; i < JOB_COUNT ; i++) {
+                      usart_job_clear(i);
+                  }
+                  break;
+        default: assert(0, "Bad Job Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    print_end_of_line();
+}
+
+
+
+#endif // USART_JOBS_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
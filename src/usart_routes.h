@@ -0,0 +1,130 @@
+//==============================================================================
+// USART to USART Routing.
+//
+// Bytes received on a routed USART (1-3) are moved from its RX FIFO
+// straight into the TX FIFO of the destination USART, so two devices can
+// talk through the board without a host round trip. Routed bytes are not
+// forwarded to the host as lines (and are not replies to polling jobs).
+// With the tap enabled they are mirrored to the host as
+// "!O<from><to><bytes:2n>", so binary traffic is safe to tap.
+//
+// Bytes are only moved while the destination TX FIFO has room, the rest
+// wait in the RX FIFO.
+//
+// Copyright OC Technology Pty Ltd 2021.
+//==============================================================================
+
+#ifndef USART_ROUTES_H_INCLUDED
+#define USART_ROUTES_H_INCLUDED
+
+
+typedef struct {
+    uint8_t to;                     // '1'-'3' (0 = not routed).
+    bool tap;
+} usart_route_t;
+
+
+static usart_route_t g_route[3];
+
+
+static fifo_t* route_tx_fifo(const uint8_t usart)
+{
+    switch(usart) {
+        case '1': return p_g_usart1_tx_fifo;
+        case '2': return p_g_usart2_tx_fifo;
+        case '3': return p_g_usart3_tx_fifo;
+        default: assert(0, "Bad USART!");
+    }
+    return NULL;
+}
+
+
+static void route_tx(const uint8_t usart, const uint8_t c)
+{
+    switch(usart) {
+        case '1': usart1_tx(c); break;
+        case '2': usart2_tx(c); break;
+        case '3': usart3_tx(c); break;
+    }
+}
+
+
+// Move up to `budget` bytes received on USART `from` ('1'-'3').
+// Returns false if `from` is not routed.
+static bool usart_route_rx(const uint8_t from, fifo_t* const rx_fifo,
+                           uint8_t budget)
+{
+    const usart_route_t* const r = &g_route[from - (uint8_t)'1'];
+    if (r->to == 0) {
+        return false;
+    }
+
+    fifo_t* const tx_fifo = route_tx_fifo(r->to);
+    bool tapped = false;
+    while (budget-- != 0
+       &&  fifo_is_not_empty(rx_fifo)
+       &&  fifo_is_not_full(tx_fifo)) {
+        const uint8_t c = fifo_read(rx_fifo);
+        route_tx(r->to, c);
+        if (r->tap) {
+            if (!tapped) {
+                print_c('!');
+                print_c('O');
+                print_c(from);
+                print_c(r->to);
+                tapped = true;
+            }
+            print_hex(c);
+        }
+    }
+    if (tapped) {
+        print_end_of_line();
+    }
+    return true;
+}
+
+
+
+/* Commands */
+
+// OS<from><to><tap>    Route USART <from> RX to USART <to> TX,
+//                      tap T = mirror to host, N = don't.
+// OX<from>             Remove route.
+// OC                   Remove all routes.
+static void usart_routes_command(const uint8_t* const p, const uint8_t l)
+{
+    assert(l >= 2, "Short Route Command!");
+
+    switch(p[1]) {
+        case 'S': assert(l == 5, "Bad Route!");
+                  assert(p[2] >= '1' && p[2] <= '3'
+                      && p[3] >= '1' && p[3] <= '3'
+                      && p[2] != p[3], "Bad USART!");
+                  assert(fifo_arena_usart_is_used(p[2])
+                      && fifo_arena_usart_is_used(p[3]), "USART Not Used!");
+                  assert(p[4] == 'T' || p[4] == 'N', "Bad Route Tap!");
+                  g_route[p[2] - (uint8_t)'1'].to = p[3];
+                  g_route[p[2] - (uint8_t)'1'].tap = p[4] == 'T';
+                  break;
+        case 'X': assert(l == 3 && p[2] >= '1' && p[2] <= '3', "Bad USART!");
+                  g_route[p[2] - (uint8_t)'1'].to = 0;
+                  break;
+        case 'C': for (uint8_t i = 0 ; i < 3 ; i++) {
+                      g_route[i].to = 0;
+                  }
+                  break;
+        default: assert(0, "Bad Route Command!");
+    }
+
+    print_c('>');
+    print_n(p, l);
+    print_end_of_line();
+}
+
+
+
+#endif // USART_ROUTES_H_INCLUDED
+
+//==============================================================================
+// End of file.
+//==============================================================================
@@ -0,0 +1,21 @@
+using ArduinoMega2560
+using ArduinoMega2560: decode_telemetry
+using Test
+
+
+@testset "decode_telemetry" begin
+
+    # The "~" line that src/host/test.c test_telemetry() gets from the
+    # firmware for "TS00030001040002": channels F0 and F1 every 1 ms,
+    # 4 sets per line, F1 as deltas.
+    format = (channels = [0, 1], delta = [false, true], period_ms = 1)
+    line = "000=Z@@I7d<Q_oT`0co4"
+
+    times, samples = decode_telemetry(format, line)
+
+    @test times == [3497, 3498, 3499, 3500]
+    @test samples == [ 100  500
+                       200  503
+                      1023  490
+                         0 1000]
+end